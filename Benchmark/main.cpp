@@ -0,0 +1,342 @@
+#include <iostream>
+#include <vector>
+#include <list>
+#include <regex>
+#include <type_traits>
+#include <string>
+#include <functional>
+#include <chrono>
+#include <atomic>
+#include <fstream>
+#include <cstdlib>
+#include <new>
+
+//The projects are single main.cpp programs, so the benchmark compiles them in with their own main renamed.
+//Week2 and Week4 both define print and iterator_support at global scope and open namespace std, so each goes
+//in a namespace of its own; every header they include is already included above.
+#define main lmm_main
+#include "../RateSimulation/main.cpp"
+#undef main
+#include "../Week6/main.cpp"
+namespace week2{
+#define main week2_main
+#include "../Week2/main.cpp"
+#undef main
+}
+namespace week4{
+#define main week4_main
+#include "../Week4/main.cpp"
+#undef main
+}
+
+//every heap allocation of the process is counted, so a case reports what one iteration allocates
+namespace benchlib{
+    std::atomic<size_t> allocation_count{0};
+    std::atomic<size_t> allocation_bytes{0};
+
+    inline void* countedAlloc(size_t size){
+        allocation_count.fetch_add(1, std::memory_order_relaxed);
+        allocation_bytes.fetch_add(size, std::memory_order_relaxed);
+        if(void* p = std::malloc(size ? size : 1)) return p;
+        throw std::bad_alloc();
+    }
+
+    inline void* countedAlignedAlloc(size_t size, std::align_val_t align){
+        allocation_count.fetch_add(1, std::memory_order_relaxed);
+        allocation_bytes.fetch_add(size, std::memory_order_relaxed);
+        size_t alignment = static_cast<size_t>(align);
+        if(void* p = std::aligned_alloc(alignment, (size + alignment - 1)/alignment*alignment)) return p;
+        throw std::bad_alloc();
+    }
+}
+
+void* operator new(size_t size){
+    return benchlib::countedAlloc(size);
+}
+void* operator new[](size_t size){
+    return benchlib::countedAlloc(size);
+}
+void* operator new(size_t size, std::align_val_t align){
+    return benchlib::countedAlignedAlloc(size, align);
+}
+void* operator new[](size_t size, std::align_val_t align){
+    return benchlib::countedAlignedAlloc(size, align);
+}
+void operator delete(void* p) noexcept{
+    std::free(p);
+}
+void operator delete[](void* p) noexcept{
+    std::free(p);
+}
+void operator delete(void* p, size_t) noexcept{
+    std::free(p);
+}
+void operator delete[](void* p, size_t) noexcept{
+    std::free(p);
+}
+void operator delete(void* p, std::align_val_t) noexcept{
+    std::free(p);
+}
+void operator delete[](void* p, std::align_val_t) noexcept{
+    std::free(p);
+}
+void operator delete(void* p, size_t, std::align_val_t) noexcept{
+    std::free(p);
+}
+void operator delete[](void* p, size_t, std::align_val_t) noexcept{
+    std::free(p);
+}
+
+namespace benchlib{
+
+    template <class V>
+    inline void keep(const V& value){//stops the optimiser from dropping a result
+        asm volatile("" : : "r"(&value) : "memory");
+    }
+
+    struct BenchmarkResult{
+        std::string name;
+        size_t iterations;
+        double items_per_iteration;
+        double seconds;//all timed iterations
+        double ns_per_item;
+        double items_per_second;
+        double allocations_per_iteration;
+        double bytes_per_iteration;
+    };
+
+    class BenchmarkSuite{
+    public:
+        //run(iterations) repeats the measured work iterations times; setup is done outside of it
+        using Case = std::function<void(size_t)>;
+
+        //one line per case goes to log as it finishes
+        BenchmarkSuite(double min_seconds, std::string filter, std::ostream& log)
+        :m_min_seconds(min_seconds),m_filter(filter),m_log(log){};
+
+        //items_per_iteration is the unit of throughput: paths, draws, queries, dates or elements
+        void add(const std::string& name, double items_per_iteration, Case run){
+            if(!m_filter.empty() && name.find(m_filter) == std::string::npos) return;
+            run(1);//warm up caches, lazily built tables and thread local buffers
+            size_t iterations = 1;
+            while(true){
+                size_t count = allocation_count.load(), bytes = allocation_bytes.load();//becomes the run's own
+                auto start = std::chrono::steady_clock::now();
+                run(iterations);
+                double seconds = std::chrono::duration<double>(std::chrono::steady_clock::now() - start).count();
+                count = allocation_count.load() - count;
+                bytes = allocation_bytes.load() - bytes;
+                if(seconds >= m_min_seconds || iterations >= (size_t(1) << 40)){
+                    double items = items_per_iteration*iterations;
+                    BenchmarkResult result{name, iterations, items_per_iteration, seconds, seconds/items*1e9, items/seconds,
+                                           double(count)/iterations, double(bytes)/iterations};
+                    m_log<<result.name<<": "<<result.ns_per_item<<" ns/item, "<<result.items_per_second<<" items/s, "
+                    <<result.allocations_per_iteration<<" allocations ("<<result.bytes_per_iteration
+                    <<" bytes) per iteration, "<<result.iterations<<" iterations"<<std::endl;
+                    m_results.push_back(result);
+                    return;
+                }
+                //aim a little past the minimum time from the last measurement
+                double scale = seconds > 0 ? 1.4*m_min_seconds/seconds : 10.0;
+                iterations = std::max(iterations + 1, size_t(iterations*std::min(scale, 10.0)));
+            }
+        }
+
+        const std::vector<BenchmarkResult>& results() const{
+            return m_results;
+        }
+
+        void writeJson(std::ostream& out) const{
+            const char* simd_names[] = {"auto", "scalar", "avx2", "avx512"};
+            out<<"{\n  \"context\": {\"simd_level\": \""<<simd_names[int(simulationlib::supportedSimdLevel())]
+            <<"\", \"hardware_threads\": "<<std::thread::hardware_concurrency()<<", \"min_seconds\": "<<m_min_seconds<<"},\n";
+            out<<"  \"benchmarks\": [";
+            for(size_t i = 0; i < m_results.size(); ++i){
+                const BenchmarkResult& r = m_results[i];
+                out<<(i ? ",\n" : "\n")<<"    {\"name\": \""<<r.name<<"\", \"iterations\": "<<r.iterations
+                <<", \"items_per_iteration\": "<<r.items_per_iteration<<", \"seconds\": "<<r.seconds
+                <<", \"ns_per_item\": "<<r.ns_per_item<<", \"items_per_second\": "<<r.items_per_second
+                <<", \"allocations_per_iteration\": "<<r.allocations_per_iteration
+                <<", \"bytes_per_iteration\": "<<r.bytes_per_iteration<<"}";
+            }
+            out<<"\n  ]\n}\n";
+        }
+
+    private:
+        double m_min_seconds;
+        std::string m_filter;
+        std::ostream& m_log;
+        std::vector<BenchmarkResult> m_results;
+    };
+
+    //the curve of the RateSimulation driver
+    const std::vector<double> init_rates {0.0005, 0.0006, 0.0007, 0.0009, 0.001,0.0016, 0.0023,0.0049,0.0082,0.0115,0.0169, 0.0188};
+    const std::vector<double> init_tenors {1.0/12.0, 1.0/6.0, 0.25, 0.5, 1,2,3,5,7,10,20,30};
+
+    void addSimulationCases(BenchmarkSuite& suite){
+        for(int rate_num : {10, 40, 120}){
+            for(unsigned long step_num : {10, 40, 160}){
+                double rate_freq = 0.25;
+                simulationlib::LiborRateSimulation<double> lmm{1, step_num*rate_freq, step_num, (rate_num+1)*rate_freq,
+                                                               rate_freq, init_rates, init_tenors};
+                lmm.setVol(0.19, 0.97, 0.08, 0.01);
+                lmm.setCorr(0.99, 0.5, 0.5);
+                lmm.setInitRate();
+                const size_t path_num = 64;//distinct shocks per iteration, regenerated outside the timing
+                size_t shock_num = step_num*lmm.getShockNum();
+                std::vector<double> shocks(path_num*shock_num);
+                simulationlib::NormalBlockGenerator<double> rand_gen(1);
+                for(size_t path = 0; path < path_num; ++path) rand_gen.fill(path, &shocks[path*shock_num], shock_num);
+                std::vector<double> F;
+                suite.add("LiborSimulationOnePath/rates:" + std::to_string(rate_num) + "/steps:" + std::to_string(step_num),
+                          path_num, [&](size_t iterations){
+                    for(size_t i = 0; i < iterations; ++i){
+                        for(size_t path = 0; path < path_num; ++path){
+                            lmm.LiborSimulationOnePath(&shocks[path*shock_num], F);
+                            keep(F[0]);
+                        }
+                    }
+                });
+            }
+        }
+    }
+
+    void addRandomMatrixCases(BenchmarkSuite& suite){
+        for(size_t num : {1, 16}){
+            for(unsigned long step_num : {64, 1024}){
+                simulationlib::RandomNumber<double> rand_num(num, std::vector<unsigned int>(num, 7), 0.0, 1.0);
+                suite.add("RandomMatrix/num:" + std::to_string(num) + "/steps:" + std::to_string(step_num), num*step_num,
+                          [&](size_t iterations){
+                    for(size_t i = 0; i < iterations; ++i){
+                        simulationlib::RandomMatrix<double> matrix(rand_num, num, step_num);
+                        keep(matrix.getRandNum(0, 0));
+                    }
+                });
+            }
+        }
+    }
+
+    void addInterpolationCases(BenchmarkSuite& suite){
+        simulationlib::RateInterpolation ri(init_tenors, init_rates);
+        for(size_t query_num : {16, 4096}){
+            std::vector<double> queries(query_num), rates(query_num);
+            std::mt19937 engine(11);
+            std::uniform_real_distribution<double> tenor(0.0, 35.0);
+            for(double& q : queries) q = tenor(engine);
+            std::string size = "/queries:" + std::to_string(query_num);
+            suite.add("RateInterpolation::getRate" + size, query_num, [&](size_t iterations){
+                for(size_t i = 0; i < iterations; ++i){
+                    for(size_t q = 0; q < query_num; ++q) rates[q] = ri.getRate(queries[q]);
+                    keep(rates[0]);
+                }
+            });
+            suite.add("RateInterpolation::getRates" + size, query_num, [&](size_t iterations){
+                for(size_t i = 0; i < iterations; ++i){
+                    ri.getRates(queries.data(), rates.data(), query_num);
+                    keep(rates[0]);
+                }
+            });
+            std::sort(queries.begin(), queries.end());
+            suite.add("RateInterpolation::getRates/sorted" + size, query_num, [&](size_t iterations){
+                for(size_t i = 0; i < iterations; ++i){
+                    ri.getRates(queries.data(), rates.data(), query_num);
+                    keep(rates[0]);
+                }
+            });
+        }
+    }
+
+    void addDateCases(BenchmarkSuite& suite){
+        const size_t date_num = 1024;
+        std::vector<datelib::Date> dates;
+        for(size_t i = 0; i < date_num; ++i) dates.emplace_back(int(i*7 % 12), 1990 + int(i % 50));
+        suite.add("datelib::Date/arithmetic", date_num, [&](size_t iterations){
+            for(size_t i = 0; i < iterations; ++i){
+                for(size_t k = 0; k < date_num; ++k){
+                    datelib::Date d = dates[k] + 3;
+                    d -= 2;
+                    ++d;
+                    d--;
+                    keep(d);
+                }
+            }
+        });
+        suite.add("datelib::Date/comparison", date_num, [&](size_t iterations){
+            for(size_t i = 0; i < iterations; ++i){
+                size_t order = 0;
+                for(size_t k = 1; k < date_num; ++k){
+                    order += (dates[k-1] < dates[k]) + (dates[k-1] == dates[k]) + (dates[k] >= dates[k-1]);
+                }
+                keep(order);
+            }
+        });
+    }
+
+    void addIteratorCases(BenchmarkSuite& suite){
+        for(size_t element_num : {1000, 100000}){
+            std::string size = "/elements:" + std::to_string(element_num);
+            std::vector<int> data(element_num);
+            for(size_t k = 0; k < element_num; ++k) data[k] = int(k);
+            std::list<int> data_list(data.begin(), data.end());
+            week2::iterator_support<int> week2_support;
+            suite.add("Week2::iterator_support/vector" + size, element_num/2, [&](size_t iterations){
+                for(size_t i = 0; i < iterations; ++i){
+                    long sum = 0;
+                    for(auto it = week2_support.begin(data); it != week2_support.end(data); ++it) sum += *it;
+                    keep(sum);
+                }
+            });
+            week4::iterator_support<int, std::vector> week4_vector;
+            suite.add("Week4::iterator_support/vector" + size, element_num/2, [&](size_t iterations){
+                for(size_t i = 0; i < iterations; ++i){
+                    long sum = 0;
+                    for(auto it = week4_vector.begin(data); it != week4_vector.end(data); ++it) sum += *it;
+                    keep(sum);
+                }
+            });
+            week4::iterator_support<int, std::list> week4_list;
+            suite.add("Week4::iterator_support/list" + size, element_num/2, [&](size_t iterations){
+                for(size_t i = 0; i < iterations; ++i){
+                    long sum = 0;
+                    for(auto it = week4_list.begin(data_list); it != week4_list.end(data_list); ++it) sum += *it;
+                    keep(sum);
+                }
+            });
+        }
+    }
+}
+
+//usage: main [--filter=substring] [--min-time=seconds] [--json=file]; the JSON goes to stdout with --json=-
+//build like Week6, which it includes: g++ -std=c++17 -O2 main.cpp -lQuantLib -lboost_unit_test_framework -pthread
+int main(int argc, char* argv[]){
+    std::string filter, json_file;
+    double min_seconds = 0.2;
+    for(int i = 1; i < argc; ++i){
+        std::string arg = argv[i];
+        if(arg.rfind("--filter=", 0) == 0) filter = arg.substr(9);
+        else if(arg.rfind("--min-time=", 0) == 0) min_seconds = std::stod(arg.substr(11));
+        else if(arg.rfind("--json=", 0) == 0) json_file = arg.substr(7);
+        else{
+            std::cerr<<"unknown argument "<<arg<<std::endl;
+            return 1;
+        }
+    }
+
+    benchlib::BenchmarkSuite suite(min_seconds, filter, json_file == "-" ? std::cerr : std::cout);
+    benchlib::addSimulationCases(suite);
+    benchlib::addRandomMatrixCases(suite);
+    benchlib::addInterpolationCases(suite);
+    benchlib::addDateCases(suite);
+    benchlib::addIteratorCases(suite);
+
+    if(json_file == "-") suite.writeJson(std::cout);
+    else if(!json_file.empty()){
+        std::ofstream out(json_file);
+        if(!out){
+            std::cerr<<"cannot write "<<json_file<<std::endl;
+            return 1;
+        }
+        suite.writeJson(out);
+    }
+    return 0;
+}
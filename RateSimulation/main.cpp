@@ -3,6 +3,34 @@
 #include <vector>
 #include <math.h>
 #include <algorithm>
+#include <thread>
+#include <atomic>
+#include <mutex>
+#include <condition_variable>
+#include <functional>
+#include <memory>
+#include <cstdint>
+#include <new>
+#include <cstring>
+#include <map>
+#include <fstream>
+#include <exception>
+#include <cstdio>
+#include <chrono>
+#include <array>
+#include <string>
+#include <stdexcept>
+#include <cerrno>
+#include <fcntl.h>
+#include <sys/mman.h>
+#include <sys/stat.h>
+#include <unistd.h>
+#include <sys/wait.h>
+#if defined(__linux__)
+#include <linux/perf_event.h>
+#include <sys/ioctl.h>
+#include <sys/syscall.h>
+#endif
 #include <boost/test/unit_test.hpp>
 #include <boost/test/framework.hpp>
 #include <boost/assert.hpp>
@@ -12,6 +40,32 @@
 
 namespace simulationlib{
 
+    template <class T, size_t Align = 64>
+    struct AlignedAllocator{//cache line aligned storage for the flat simulation tables
+        using value_type = T;
+        template <class U> struct rebind{
+            using other = AlignedAllocator<U, Align>;
+        };
+        AlignedAllocator() = default;
+        template <class U> AlignedAllocator(const AlignedAllocator<U, Align>&){};
+
+        T* allocate(size_t n){
+            return static_cast<T*>(::operator new(n*sizeof(T), std::align_val_t(Align)));
+        }
+        void deallocate(T* p, size_t){
+            ::operator delete(p, std::align_val_t(Align));
+        }
+        template <class U> bool operator==(const AlignedAllocator<U, Align>&) const{
+            return true;
+        }
+        template <class U> bool operator!=(const AlignedAllocator<U, Align>&) const{
+            return false;
+        }
+    };
+
+    template <class T>
+    using AlignedVector = std::vector<T, AlignedAllocator<T>>;
+
     template <class T>
     class RandomNumber{
     public:
@@ -48,10 +102,17 @@ namespace simulationlib{
         :m_num(num),m_steps(steps),m_rand_num {num, mean, stddev},m_rand_matrix(num, std::vector<T> (steps, 0)){
             createRandMatrix();
         }
+        RandomMatrix(RandomNumber<T>& rand_num, size_t num, unsigned long steps)//draws from a caller owned generator
+        :m_num(num),m_steps(steps),m_rand_num {0, 0, 1},m_rand_matrix(num, std::vector<T> (steps, 0)){
+            createRandMatrix(rand_num);
+        }
         void createRandMatrix(){
+            createRandMatrix(m_rand_num);
+        }
+        void createRandMatrix(RandomNumber<T>& rand_num){
             for(size_t i = 0; i < m_num;++i){
                 for (unsigned long j = 0; j < m_steps; ++j){
-                    m_rand_matrix[i][j] = m_rand_num.getNormalRand(i);
+                    m_rand_matrix[i][j] = rand_num.getNormalRand(i);
                 }
             }
         }
@@ -65,179 +126,4063 @@ namespace simulationlib{
         std::vector<std::vector<T>> m_rand_matrix;
     };
 
-    class RateInterpolation{
+    class ZigguratTables{//Marsaglia-Tsang tables for the 128 layer normal ziggurat
     public:
-        RateInterpolation(std::vector<double> tenors, std::vector<double> rates):m_rates(rates),m_tenors(tenors){};
-        double getRate(double tenor){
-            int index = std::lower_bound (m_tenors.begin(), m_tenors.end(), tenor) - m_tenors.begin();
-            if(index == 0) return m_rates[0];
-            else if(index >= m_tenors.size()) return m_rates.back();
-            else{
-                double slope = (m_rates[index] - m_rates[index-1])/(m_tenors[index] - m_tenors[index-1]);
-                return m_rates[index-1] + slope*(tenor - m_tenors[index-1]);
+        static const ZigguratTables& instance(){
+            static const ZigguratTables tables;
+            return tables;
+        }
+        static constexpr double r = 3.442619855899;//start of the tail
+
+        int64_t kn[128];//acceptance thresholds on the signed 32 bit draw
+        double wn[128];//layer widths
+        double fn[128];//density at the layer edges
+
+    private:
+        ZigguratTables(){
+            const double m1 = 2147483648.0, vn = 9.91256303526217e-3;
+            double dn = r, tn = dn;
+            double q = vn/exp(-0.5*dn*dn);
+            kn[0] = static_cast<int64_t>((dn/q)*m1);
+            kn[1] = 0;
+            wn[0] = q/m1;
+            wn[127] = dn/m1;
+            fn[0] = 1.0;
+            fn[127] = exp(-0.5*dn*dn);
+            for(int i = 126; i >= 1; --i){
+                dn = sqrt(-2.0*log(vn/dn + exp(-0.5*dn*dn)));
+                kn[i+1] = static_cast<int64_t>((dn/tn)*m1);
+                tn = dn;
+                fn[i] = exp(-0.5*dn*dn);
+                wn[i] = dn/m1;
             }
         }
-        double getRate(double t1, double t2){
-            return (getRate(t2)*t2-getRate(t1)*t1)/(t2-t1);
+    };
+
+    //Philox4x32-10 (Salmon et al. 2011): counter based, the output for any counter is computed directly
+    inline void philox4x32(uint32_t counter[4], uint32_t key0, uint32_t key1){
+        for(int round = 0; round < 10; ++round){
+            uint64_t p0 = uint64_t(0xD2511F53u)*counter[0];
+            uint64_t p1 = uint64_t(0xCD9E8D57u)*counter[2];
+            uint32_t c1 = counter[1], c3 = counter[3];
+            counter[0] = uint32_t(p1 >> 32) ^ c1 ^ key0;
+            counter[1] = uint32_t(p1);
+            counter[2] = uint32_t(p0 >> 32) ^ c3 ^ key1;
+            counter[3] = uint32_t(p0);
+            key0 += 0x9E3779B9u;
+            key1 += 0xBB67AE85u;
+        }
+    }
+
+    //SplitMix64 (Steele et al. 2014): advances state and returns its next well mixed 64 bits
+    inline uint64_t splitMix(uint64_t& state){
+        uint64_t z = (state += 0x9E3779B97F4A7C15ULL);
+        z = (z ^ (z >> 30))*0xBF58476D1CE4E5B9ULL;
+        z = (z ^ (z >> 27))*0x94D049BB133111EBULL;
+        return z ^ (z >> 31);
+    }
+
+    template <class T>
+    class NormalBlockGenerator{//standard normals keyed on (seed, path, index), written in bulk by a two pass ziggurat
+    public:
+        explicit NormalBlockGenerator(uint64_t seed):m_key0(uint32_t(seed)),m_key1(uint32_t(seed >> 32)){};
+
+        //out[k*stride] = normal k of path, k < n; any path or index can be regenerated on its own
+        void fill(uint64_t path, T* out, size_t n, size_t stride = 1){
+            const ZigguratTables& zt = ZigguratTables::instance();
+            m_bits.resize(n + 1);
+            m_reject.clear();
+            for(size_t c = 0; c < (n + 1)/2; ++c){//one Philox block gives the 64 bit draws of indices 2c and 2c+1
+                uint32_t counter[4] = {uint32_t(c), uint32_t(uint64_t(c) >> 32), uint32_t(path), uint32_t(path >> 32)};
+                philox4x32(counter, m_key0, m_key1);
+                m_bits[2*c] = (uint64_t(counter[0]) << 32) | counter[1];
+                m_bits[2*c+1] = (uint64_t(counter[2]) << 32) | counter[3];
+            }
+            for(size_t k = 0; k < n; ++k){//fast path, branch free: one layer lookup and multiply per draw
+                int64_t hz = static_cast<int32_t>(m_bits[k] >> 32);
+                size_t iz = m_bits[k] & 127;
+                out[k*stride] = static_cast<T>(hz*zt.wn[iz]);
+                if((hz < 0 ? -hz : hz) >= zt.kn[iz]) m_reject.push_back(k);
+            }
+            for(size_t k : m_reject){//about 2.8% of draws land outside the rectangles
+                out[k*stride] = static_cast<T>(slowPath(m_bits[k]));
+            }
+            m_reject_count += m_reject.size();
+        }
+
+        size_t rejectCount() const{//draws that took the slow path, over every fill
+            return m_reject_count;
         }
+
     private:
-        std::vector<double> m_tenors;
-        std::vector<double> m_rates;
+        static double uniform(uint64_t& state){//in (0,1)
+            return ((splitMix(state) >> 11) + 0.5)*(1.0/9007199254740992.0);
+        }
+
+        static double slowPath(uint64_t bits){//further draws come from a stream seeded by the rejected draw itself
+            const ZigguratTables& zt = ZigguratTables::instance();
+            uint64_t state = bits;
+            while(true){
+                int64_t hz = static_cast<int32_t>(bits >> 32);
+                size_t iz = bits & 127;
+                if((hz < 0 ? -hz : hz) < zt.kn[iz]) return hz*zt.wn[iz];
+                double x = hz*zt.wn[iz];
+                if(iz == 0){//sample the tail beyond r
+                    double y;
+                    do{
+                        x = -log(uniform(state))/ZigguratTables::r;
+                        y = -log(uniform(state));
+                    } while(y + y < x*x);
+                    return hz > 0 ? ZigguratTables::r + x : -ZigguratTables::r - x;
+                }
+                if(zt.fn[iz] + uniform(state)*(zt.fn[iz-1] - zt.fn[iz]) < exp(-0.5*x*x)) return x;
+                bits = splitMix(state);
+            }
+        }
+
+        uint32_t m_key0, m_key1;
+        std::vector<uint64_t> m_bits;//reused between calls
+        std::vector<size_t> m_reject;
+        size_t m_reject_count = 0;
     };
 
+    //inverse of the standard normal cdf, Acklam's rational approximation (relative error below 1.2e-9)
+    inline double inverseNormal(double u){
+        static const double a[6] = {-3.969683028665376e+01, 2.209460984245205e+02, -2.759285104469687e+02,
+                                    1.383577518672690e+02, -3.066479806614716e+01, 2.506628277459239e+00};
+        static const double b[5] = {-5.447609879822406e+01, 1.615858368580409e+02, -1.556989798598866e+02,
+                                    6.680131188771972e+01, -1.328068155288572e+01};
+        static const double c[6] = {-7.784894002430293e-03, -3.223964580411365e-01, -2.400758277161838e+00,
+                                    -2.549732539343734e+00, 4.374664141464968e+00, 2.938163982698783e+00};
+        static const double d[4] = {7.784695709041462e-03, 3.224671290700398e-01, 2.445134137142996e+00,
+                                    3.754408661907416e+00};
+        const double p_low = 0.02425;
+        double x;
+        if(u < p_low){
+            double q = sqrt(-2*log(u));
+            x = (((((c[0]*q+c[1])*q+c[2])*q+c[3])*q+c[4])*q+c[5])/((((d[0]*q+d[1])*q+d[2])*q+d[3])*q+1);
+        }
+        else if(u <= 1 - p_low){
+            double q = u - 0.5, r = q*q;
+            x = (((((a[0]*r+a[1])*r+a[2])*r+a[3])*r+a[4])*r+a[5])*q/(((((b[0]*r+b[1])*r+b[2])*r+b[3])*r+b[4])*r+1);
+        }
+        else{
+            double q = sqrt(-2*log(1-u));
+            x = -(((((c[0]*q+c[1])*q+c[2])*q+c[3])*q+c[4])*q+c[5])/((((d[0]*q+d[1])*q+d[2])*q+d[3])*q+1);
+        }
+        return x;
+    }
 
-    template <class T>
-    class LiborRateSimulation{
+    class SobolSequence{//Gray code Sobol points in [0,1)^dims, optionally with a random linear scramble and digital shift
     public:
-        LiborRateSimulation(int simulation_nums, double projection_years,unsigned long num_time_steps, double maturity,
-                            double rate_freq,std::vector<T> rates, std::vector<T> tenors)
-        :m_simulation_nums(simulation_nums),m_projection_years(projection_years),m_num_time_steps(num_time_steps),m_maturity(maturity),
-         m_rate_freq(rate_freq),m_ri(tenors, rates),m_init_rates(maturity/rate_freq-1, 0),
-        m_sigma(maturity/rate_freq-1, 0), m_corr(maturity/rate_freq-1, std::vector<T> (maturity/rate_freq-1,0)),
-        m_output(m_simulation_nums){
-            m_dt = projection_years/num_time_steps;
-            m_num_rates = maturity/rate_freq-1;
-        };
+        SobolSequence(size_t dims, uint64_t scramble_seed = 0)//seed 0 gives the plain sequence
+        :m_dims(dims),m_direction(dims*32, 0),m_state(dims, 0),m_shift(dims, 0){
+            //Joe-Kuo (new-joe-kuo-6) degree, coefficients and initial direction numbers of dimensions 2 to 21,
+            //later dimensions use the next primitive polynomials with pseudo random odd initial numbers
+            static const unsigned int joe_kuo[20][9] = {
+                {1,0,1},{2,1,1,3},{3,1,1,3,1},{3,2,1,1,1},{4,1,1,1,3,3},{4,4,1,3,5,13},{5,2,1,1,5,5,17},
+                {5,4,1,1,5,5,5},{5,7,1,1,7,11,19},{5,11,1,1,5,1,1},{5,13,1,1,1,3,11},{5,14,1,3,5,5,31},
+                {6,1,1,3,3,9,7,49},{6,13,1,1,1,15,21,21},{6,16,1,3,1,13,27,49},{6,19,1,1,1,15,7,5},
+                {6,22,1,3,1,15,13,25},{6,25,1,1,5,5,19,61},{7,1,1,3,7,11,23,15,103},{7,4,1,3,7,13,13,15,69}};
+            for(unsigned int k = 0; k < 32; ++k) m_direction[k] = 1u << (31-k);
+            unsigned int degree = 1, coef = 0;
+            uint64_t mix = 0x9E3779B97F4A7C15ULL;
+            for(size_t d = 1; d < dims; ++d){
+                if(d > 1) nextPrimitive(degree, coef);
+                uint32_t* v = &m_direction[d*32];
+                for(unsigned int k = 0; k < degree && k < 32; ++k){
+                    uint32_t m_k = d <= 20 ? joe_kuo[d-1][2+k] : static_cast<uint32_t>(splitMix(mix) >> (64-(k+1))) | 1u;
+                    v[k] = m_k << (31-k);
+                }
+                for(unsigned int k = degree; k < 32; ++k){
+                    v[k] = v[k-degree] ^ (v[k-degree] >> degree);
+                    for(unsigned int i = 1; i < degree; ++i){
+                        if((coef >> (degree-1-i)) & 1u) v[k] ^= v[k-i];
+                    }
+                }
+            }
+            if(scramble_seed != 0){
+                uint64_t state = scramble_seed;
+                for(size_t d = 0; d < dims; ++d){
+                    uint32_t scramble[32];//random lower triangular matrix with unit diagonal, row r acts on bit 31-r
+                    for(unsigned int r = 0; r < 32; ++r){
+                        uint32_t below = r ? static_cast<uint32_t>(splitMix(state)) >> (32-r) : 0;
+                        scramble[r] = (1u << (31-r)) | (below << (32-r));
+                    }
+                    for(unsigned int k = 0; k < 32; ++k){
+                        uint32_t v = m_direction[d*32+k], w = 0;
+                        for(unsigned int r = 0; r < 32; ++r){
+                            if(__builtin_popcount(scramble[r] & v) & 1) w |= 1u << (31-r);
+                        }
+                        m_direction[d*32+k] = w;
+                    }
+                    m_shift[d] = static_cast<uint32_t>(splitMix(state));
+                }
+            }
+            skipTo(0);
+        }
 
-        void setInitRate(){//get initial rates from time 0 rate curve
-            for(int i = 1; i <= m_num_rates;++i)
-                m_init_rates[i-1] = m_ri.getRate(m_rate_freq*i,m_rate_freq*i+m_rate_freq);
+        size_t dimension() const{
+            return m_dims;
         }
 
-        void setCorr(double rho_inf, double lambda, double kai){
-            for(int i = 1; i <= m_num_rates;++i){
-                for(int j = 1; j <= m_num_rates;++j){
-                    m_corr[i-1][j-1] = rho_inf+(1-rho_inf)*
-                            exp(-lambda*abs(i*m_rate_freq-j*m_rate_freq)/(1+kai*std::min(i*m_rate_freq,j*m_rate_freq)));
+        void skipTo(uint64_t index){//next() then returns point index of the Gray code ordering
+            uint64_t gray = index ^ (index >> 1);
+            for(size_t d = 0; d < m_dims; ++d){
+                uint32_t x = m_shift[d];
+                for(unsigned int k = 0; k < 32 && (gray >> k); ++k){
+                    if((gray >> k) & 1) x ^= m_direction[d*32+k];
                 }
+                m_state[d] = x;
             }
+            m_index = index;
         }
-        T getCorr(int i, int j){
-            return m_corr[i-1][j-1];
+
+        void next(double* u){//points are centred in their 2^-32 cell so they never touch 0 or 1
+            for(size_t d = 0; d < m_dims; ++d) u[d] = (m_state[d] + 0.5)*(1.0/4294967296.0);
+            unsigned int k = __builtin_ctzll(~m_index);//bit that flips between Gray codes of index and index+1
+            for(size_t d = 0; d < m_dims; ++d) m_state[d] ^= m_direction[d*32+k];
+            ++m_index;
         }
 
+    private:
+        static uint64_t mulMod(uint64_t x, uint64_t y, uint64_t poly, unsigned int degree){//product in GF(2)[x]/poly
+            uint64_t r = 0;
+            while(y){
+                if(y & 1) r ^= x;
+                y >>= 1;
+                x <<= 1;
+                if((x >> degree) & 1) x ^= poly;
+            }
+            return r;
+        }
 
-        void setVol(double a, double b, double c, double d){
-            for(int i = 1; i <= m_num_rates;++i){//this vol form allows a humped shape of instantaneous volatility
-                m_sigma[i-1] = (a*(i*m_rate_freq)+d)*exp(-b*(i*m_rate_freq))+c;
+        static bool isPrimitive(unsigned int degree, unsigned int coef){//x has order 2^degree-1 modulo the polynomial
+            uint64_t poly = (1ULL << degree) | (uint64_t(coef) << 1) | 1ULL;
+            uint64_t order = (1ULL << degree) - 1;
+            auto power = [&](uint64_t e){
+                uint64_t result = 1, base = degree > 1 ? 2 : 1;
+                for(; e; e >>= 1){
+                    if(e & 1) result = mulMod(result, base, poly, degree);
+                    base = mulMod(base, base, poly, degree);
+                }
+                return result;
+            };
+            if(power(order) != 1) return false;
+            uint64_t rest = order;
+            for(uint64_t q = 2; q*q <= rest; ++q){//x^(order/q) != 1 for every prime factor q
+                if(rest % q) continue;
+                if(power(order/q) == 1) return false;
+                while(rest % q == 0) rest /= q;
             }
+            return rest == 1 || power(order/rest) != 1;
         }
 
-        T getVol(double t){
-            return m_sigma[t/m_rate_freq-1];
+        static void nextPrimitive(unsigned int& degree, unsigned int& coef){//polynomials ordered by degree then coefficients
+            while(true){
+                if(++coef >= (1u << (degree-1))){
+                    ++degree;
+                    coef = 0;
+                }
+                if(isPrimitive(degree, coef)) return;
+            }
         }
 
-        T validateVol(int rate_index, std::vector<int> vol_tenors){
-            //Target Variance
-            T target_var = 0.0;
-            for(int i = 0; i < vol_tenors.size(); ++i){//loop all the vol_tenors
-                target_var+=getVol(vol_tenors[i]*m_rate_freq)*getVol(vol_tenors[i]*m_rate_freq)*m_dt;
+        size_t m_dims;
+        std::vector<uint32_t> m_direction;//dims*32 direction numbers
+        std::vector<uint32_t> m_state;
+        std::vector<uint32_t> m_shift;
+        uint64_t m_index = 0;
+    };
+
+    class BrownianBridge{//orders the normals of a path so the first ones fix its coarse shape
+    public:
+        explicit BrownianBridge(const std::vector<double>& times)//increasing step end times, starting after 0
+        :m_times(times),m_size(times.size()),m_bridge(m_size),m_left(m_size),m_right(m_size),
+         m_left_weight(m_size),m_right_weight(m_size),m_std_dev(m_size),m_path(m_size){
+            if(m_size == 0) return;
+            std::vector<size_t> map(m_size, 0);
+            map[m_size-1] = 1;
+            m_bridge[0] = m_size-1;
+            m_std_dev[0] = sqrt(times[m_size-1]);
+            size_t j = 0;
+            for(size_t i = 1; i < m_size; ++i){
+                while(map[j]) ++j;
+                size_t k = j;
+                while(!map[k]) ++k;
+                size_t l = j + ((k-1-j) >> 1);//midpoint of the gap [j, k-1]
+                map[l] = i;
+                m_bridge[i] = l;
+                m_left[i] = j;
+                m_right[i] = k;
+                double t_left = j ? times[j-1] : 0.0;
+                m_left_weight[i] = (times[k] - times[l])/(times[k] - t_left);
+                m_right_weight[i] = (times[l] - t_left)/(times[k] - t_left);
+                m_std_dev[i] = sqrt((times[l] - t_left)*(times[k] - times[l])/(times[k] - t_left));
+                j = k + 1;
+                if(j >= m_size) j = 0;
             }
+        }
 
-            //Calculated Variance
-            std::vector<T> selected_rates(m_simulation_nums, 0.0);
-            std::vector<T> selected_norm_rates(m_simulation_nums, 0.0);
-            T square_sum = 0.0, sum = 0.0,calc_var = 0.0;
-            for(int i = 0; i < m_simulation_nums; ++i){//number of simulation
-                selected_rates[i]= m_output[i][rate_index-1];
-                selected_norm_rates[i] = log(selected_rates[i]);
-                square_sum += selected_norm_rates[i]*selected_norm_rates[i];
-                sum += selected_norm_rates[i];
+        //z[i*z_stride] are normals in bridge order, out[i*out_stride] the standard normal increment of step i
+        template <class T>
+        void transform(const double* z, size_t z_stride, T* out, size_t out_stride){
+            if(m_size == 0) return;
+            m_path[m_size-1] = m_std_dev[0]*z[0];
+            for(size_t i = 1; i < m_size; ++i){
+                size_t j = m_left[i], k = m_right[i], l = m_bridge[i];
+                m_path[l] = (j ? m_left_weight[i]*m_path[j-1] : 0.0) + m_right_weight[i]*m_path[k]
+                            + m_std_dev[i]*z[i*z_stride];
             }
-            calc_var = square_sum/(m_simulation_nums-1) - sum*sum/(m_simulation_nums-1)/m_simulation_nums;
+            for(size_t i = m_size-1; i > 0; --i){
+                out[i*out_stride] = static_cast<T>((m_path[i] - m_path[i-1])/sqrt(m_times[i] - m_times[i-1]));
+            }
+            out[0] = static_cast<T>(m_path[0]/sqrt(m_times[0]));
+        }
 
-            T test_stat = (m_simulation_nums-1)*sqrt(calc_var/target_var);//Test Statistic
-            
-            std::cout<<"Test Statistic: "<<test_stat<<", Degree of Freedom: "<<m_simulation_nums-1<<std::endl;
-            std::cout<<"Calculated Variance: "<<calc_var<<", Target Variance: "<<target_var
-            <<", ABS Error: "<<abs(calc_var-target_var)<<", Percentage Error: "<<calc_var/target_var - 1.0<<std::endl;
+    private:
+        std::vector<double> m_times;
+        size_t m_size;
+        std::vector<size_t> m_bridge, m_left, m_right;
+        std::vector<double> m_left_weight, m_right_weight, m_std_dev;
+        std::vector<double> m_path;
+    };
 
-            return calc_var/target_var - 1.0;
+    template <class T>
+    class SobolBridgeGenerator{//quasi random shocks: one Sobol point per path, each rate bridged over the time steps
+    public:
+        SobolBridgeGenerator(size_t num_rates, const std::vector<double>& times, uint64_t scramble_seed)
+        :m_num_rates(num_rates),m_num_steps(times.size()),m_sobol(num_rates*times.size(), scramble_seed),
+         m_bridge(times),m_point(num_rates*times.size()){};
+
+        void skipTo(uint64_t path){
+            m_sobol.skipTo(path);
         }
 
-        std::vector<std::vector<T>> LiborSimulation(){
-            for(int i = 0; i < m_simulation_nums; ++i){//number of simulation
-                m_output[i]= LiborSimulationOnePath();
+        //shocks of the next path, rate j of step i at shocks[(i*num_rates+j)*stride]; the point is laid out
+        //bridge level major, so its leading dimensions set the terminal values of every rate
+        void fill(T* shocks, size_t stride){
+            m_sobol.next(m_point.data());
+            for(double& u : m_point) u = inverseNormal(u);
+            for(size_t j = 0; j < m_num_rates; ++j){
+                m_bridge.transform(&m_point[j], m_num_rates, &shocks[j*stride], m_num_rates*stride);
             }
-            return m_output;
         }
 
-        std::vector<T> LiborSimulationOnePath(){
-            RandomMatrix<T> rand_matrix(m_num_rates, m_num_time_steps,0,1);//generate random number matrix
-            double mu = 0;//drift term
-            std::vector<T> F = m_init_rates;
+    private:
+        size_t m_num_rates;
+        size_t m_num_steps;
+        SobolSequence m_sobol;
+        BrownianBridge m_bridge;
+        std::vector<double> m_point;
+    };
 
-            for(unsigned long i = 0; i < m_num_time_steps;++i){//time step
-                for(int j = 1; j <= m_num_rates; ++j){//Libor rates
-                    mu = 0;
-                    for (int k = 1; k <= j; ++k) {//calculate drift term
-                        mu += (getCorr(j,k) * getVol(k*m_rate_freq) * getVol(j*m_rate_freq) * m_rate_freq * F[k - 1])
-                              / (1 + m_rate_freq * F[k - 1]) * m_dt;
+    enum class SimdLevel{Auto, Scalar, Avx2, Avx512};//instruction set of the across paths kernel
+
+    enum class ShockSource{PseudoRandom, Sobol};//Philox ziggurat normals or scrambled Sobol with bridge
+
+    //LiborSimulationScenarios loop order: every scenario per group of SIMD lanes, or one scenario over a whole
+    //chunk of paths at a time so its tables stay in cache; both give the same results
+    enum class ScenarioOrder{Lockstep, Blocked};
+
+    inline SimdLevel supportedSimdLevel(){
+#if defined(__x86_64__) || defined(__i386__)
+        if(__builtin_cpu_supports("avx512f")) return SimdLevel::Avx512;
+        if(__builtin_cpu_supports("avx2") && __builtin_cpu_supports("fma")) return SimdLevel::Avx2;
+#endif
+        return SimdLevel::Scalar;
+    }
+
+    class RateInterpolation{//linear in the rates between tenors, flat beyond the first and last tenor
+    public:
+        RateInterpolation(std::vector<double> tenors, std::vector<double> rates)
+        :m_tenors(tenors),m_rates(rates),m_widths(tenors.size() > 1 ? tenors.size()-1 : 0),m_slopes(m_widths.size()){
+            for(size_t k = 0; k < m_slopes.size(); ++k){//segment k runs from tenor k to tenor k+1
+                m_widths[k] = m_tenors[k+1] - m_tenors[k];
+                m_slopes[k] = (m_rates[k+1] - m_rates[k])/m_widths[k];
+            }
+        };
+        double getRate(double tenor) const{
+            return rateAt(std::lower_bound(m_tenors.begin(), m_tenors.end(), tenor) - m_tenors.begin(), tenor);
+        }
+        double getRate(double t1, double t2) const{
+            return (getRate(t2)*t2-getRate(t1)*t1)/(t2-t1);
+        }
+
+        //rates[q] = getRate(tenors[q]) for n queries. Large query vectors go through the branch free SIMD kernel,
+        //smaller ascending ones are merged with the tenors in one pass, anything else is searched per query.
+        void getRates(const double* tenors, double* rates, size_t n) const{
+            if(n >= 64){
+                SimdLevel level = supportedSimdLevel();
+#if defined(__x86_64__) || defined(__i386__)
+                if(level == SimdLevel::Avx512) return hingeRatesAvx512(tenors, rates, n);
+                if(level == SimdLevel::Avx2) return hingeRatesAvx2(tenors, rates, n);
+#endif
+                return hingeRates<2>(tenors, rates, n);
+            }
+            if(std::is_sorted(tenors, tenors + n)){
+                size_t index = 0;//first tenor not below the query, as lower_bound finds it
+                for(size_t q = 0; q < n; ++q){
+                    while(index < m_tenors.size() && m_tenors[index] < tenors[q]) ++index;
+                    rates[q] = rateAt(index, tenors[q]);
+                }
+                return;
+            }
+            for(size_t q = 0; q < n; ++q) rates[q] = getRate(tenors[q]);
+        }
+    private:
+        double rateAt(size_t index, double tenor) const{//index of the first tenor not below tenor
+            if(index == 0) return m_rates[0];
+            else if(index >= m_tenors.size()) return m_rates.back();
+            else return m_rates[index-1] + m_slopes[index-1]*(tenor - m_tenors[index-1]);
+        }
+
+        //the curve as a sum of clamped ramps, rate(t) = rate_0 + sum_k slope_k*min(max(t - tenor_k, 0), width_k):
+        //no search and no gather, W queries at a time; equal to getRate up to rounding
+        template <size_t W>
+        __attribute__((always_inline)) inline void hingeRates(const double* __restrict tenors, double* __restrict rates, size_t n) const{
+            size_t q = 0;
+            for(; q + W <= n; q += W){
+                double sum[W];
+                for(size_t l = 0; l < W; ++l) sum[l] = m_rates[0];
+                for(size_t k = 0; k < m_slopes.size(); ++k){
+                    const double start = m_tenors[k], width = m_widths[k], slope = m_slopes[k];
+                    for(size_t l = 0; l < W; ++l){
+                        double x = tenors[q+l] - start;
+                        x = x < 0 ? 0 : x;
+                        x = x > width ? width : x;
+                        sum[l] += slope*x;
                     }
-                    F[j-1]=F[j-1]*exp(mu*m_dt - 0.5*getVol(j*m_rate_freq)*getVol(j*m_rate_freq)*m_dt+
-                                              getVol(j*m_rate_freq)*rand_matrix.getRandNum(j-1,i)*sqrt(m_dt));
                 }
+                for(size_t l = 0; l < W; ++l) rates[q+l] = sum[l];
+            }
+            for(; q < n; ++q) rates[q] = getRate(tenors[q]);
+        }
+
+#if defined(__x86_64__) || defined(__i386__)
+        __attribute__((target("avx512f"))) void hingeRatesAvx512(const double* tenors, double* rates, size_t n) const{
+            hingeRates<16>(tenors, rates, n);//two registers of lanes hide the add latency
+        }
+
+        __attribute__((target("avx2,fma"))) void hingeRatesAvx2(const double* tenors, double* rates, size_t n) const{
+            hingeRates<8>(tenors, rates, n);
+        }
+#endif
+
+        std::vector<double> m_tenors;
+        std::vector<double> m_rates;
+        std::vector<double> m_widths;//tenor k+1 - tenor k
+        std::vector<double> m_slopes;//rate change per year on segment k
+    };
+
+
+    //persistent workers, kept by a simulation across its runs; parallelFor deals chunks round robin and idle
+    //workers steal chunks
+    class ThreadPool{
+    public:
+        explicit ThreadPool(size_t thread_num):m_thread_num(std::max<size_t>(thread_num,1)),m_cursor(m_thread_num){
+            for(size_t i = 1; i < m_thread_num; ++i){//the calling thread acts as worker 0
+                m_workers.emplace_back([this, i]{workerLoop(i);});
             }
-            return F;
+        }
+        ~ThreadPool(){
+            {
+                std::lock_guard<std::mutex> lock(m_mutex);
+                m_stop = true;
+            }
+            m_start_cv.notify_all();
+            for(auto& worker : m_workers) worker.join();
+        }
+        ThreadPool(const ThreadPool&) = delete;
+        ThreadPool& operator=(const ThreadPool&) = delete;
+
+        size_t size() const{
+            return m_thread_num;
+        }
+
+        //calls task(worker_id, chunk_begin, chunk_end) for consecutive chunks of at most grain items covering [begin,end);
+        //if a task throws, no further chunks are handed out and the first exception is rethrown here once all
+        //workers are idle
+        void parallelFor(size_t begin, size_t end, size_t grain,
+                         const std::function<void(size_t, size_t, size_t)>& task){
+            if(end <= begin) return;
+            grain = std::max<size_t>(grain, 1);
+            //worker w owns chunks w, w+thread_num, ...: chunks are taken roughly in order, so a caller merging
+            //them in order only ever waits on a few chunks per worker
+            for(size_t w = 0; w < m_thread_num; ++w){
+                m_cursor[w].next = begin + w*grain;
+                m_cursor[w].end = end;
+            }
+            {
+                std::lock_guard<std::mutex> lock(m_mutex);
+                m_task = &task;
+                m_grain = grain;
+                m_busy = m_thread_num - 1;
+                m_error = nullptr;
+                m_failed = false;
+                ++m_generation;
+            }
+            m_start_cv.notify_all();
+            runWorker(0);
+            std::unique_lock<std::mutex> lock(m_mutex);
+            m_done_cv.wait(lock, [this]{return m_busy == 0;});
+            m_task = nullptr;
+            if(m_error) std::rethrow_exception(m_error);
         }
 
     private:
-        RateInterpolation m_ri;
+        struct alignas(64) Cursor{//padded so workers do not share cache lines
+            std::atomic<size_t> next{0};
+            size_t end = 0;
+        };
 
-        int m_simulation_nums;
+        bool takeChunk(size_t w, size_t& chunk_begin, size_t& chunk_end){
+            if(m_failed) return false;
+            Cursor& cursor = m_cursor[w];
+            chunk_begin = cursor.next.fetch_add(m_grain*m_thread_num);
+            if(chunk_begin >= cursor.end) return false;
+            chunk_end = std::min(chunk_begin + m_grain, cursor.end);
+            return true;
+        }
 
-        //simulation steps
-        double m_projection_years;//simulation years
-        unsigned long m_num_time_steps;//number of steps
-        double m_dt;//length of simulation step
+        void runWorker(size_t worker_id){
+            try{
+                size_t chunk_begin, chunk_end;
+                while(takeChunk(worker_id, chunk_begin, chunk_end)){//own chunks first
+                    (*m_task)(worker_id, chunk_begin, chunk_end);
+                }
+                for(size_t k = 1; k < m_thread_num; ++k){//then steal from the other workers
+                    size_t victim = (worker_id + k) % m_thread_num;
+                    while(takeChunk(victim, chunk_begin, chunk_end)){
+                        (*m_task)(worker_id, chunk_begin, chunk_end);
+                    }
+                }
+            }
+            catch(...){//kept for parallelFor, which rethrows it on the calling thread
+                std::lock_guard<std::mutex> lock(m_mutex);
+                if(!m_error) m_error = std::current_exception();
+                m_failed = true;
+            }
+        }
 
-        //Libor Curves
-        double m_maturity;//time to maturity of Libor Curve
-        double m_rate_freq;//libor frequency
-        int m_num_rates;//number of Libor rates
+        void workerLoop(size_t worker_id){
+            size_t seen_generation = 0;
+            while(true){
+                {
+                    std::unique_lock<std::mutex> lock(m_mutex);
+                    m_start_cv.wait(lock, [&]{return m_stop || m_generation != seen_generation;});
+                    if(m_stop) return;
+                    seen_generation = m_generation;
+                }
+                runWorker(worker_id);
+                {
+                    std::lock_guard<std::mutex> lock(m_mutex);
+                    --m_busy;
+                }
+                m_done_cv.notify_one();
+            }
+        }
 
-        std::vector<T> m_init_rates;
-        std::vector<std::vector<T>> m_corr;//correlation matrix
-        std::vector<T> m_sigma;//rate vol
-        std::vector<std::vector<T>> m_output;
+        size_t m_thread_num;
+        std::vector<Cursor> m_cursor;
+        std::vector<std::thread> m_workers;
+        std::mutex m_mutex;
+        std::condition_variable m_start_cv;
+        std::condition_variable m_done_cv;
+        const std::function<void(size_t, size_t, size_t)>* m_task = nullptr;
+        size_t m_grain = 1;
+        size_t m_busy = 0;
+        size_t m_generation = 0;
+        bool m_stop = false;
+        std::exception_ptr m_error;//first exception of the current parallelFor
+        std::atomic<bool> m_failed{false};
     };
-}
 
-int main(){
+    //owner of a pool kept across runs; a copy starts without one, threads belong to the object that made them
+    class PoolSlot{
+    public:
+        PoolSlot() = default;
+        PoolSlot(const PoolSlot&){}
+        PoolSlot& operator=(const PoolSlot&){
+            return *this;
+        }
 
-    int simulation_nums = 1000000;//number of simulations
+        ThreadPool& get(size_t thread_num){//the kept pool, rebuilt when thread_num changes
+            if(!m_pool || m_pool->size() != std::max<size_t>(thread_num, 1)) m_pool.reset(new ThreadPool(thread_num));
+            return *m_pool;
+        }
+        void reset(){
+            m_pool.reset();
+        }
+        void abandon(){//in a forked child: the workers were not copied, so the pool can be neither used nor joined
+            m_pool.release();
+        }
 
-    double projection_years = 0.75;//years of projection
-    unsigned long num_time_steps = 3;//number of time steps
-    //projection_years/num_time_steps = length of each time step
+    private:
+        std::unique_ptr<ThreadPool> m_pool;
+    };
 
-    double maturity = 1;//term structure maturity
-    double rate_freq = 0.25;//libor length
-    //maturity/rate_freq = number of rates in term structure
+    //collects per chunk results from the workers and hands them on strictly in chunk order, so sums do not
+    //depend on which worker ran which chunk; with chunks dealt round robin only a few results per worker wait
+    template <class Result>
+    class OrderedMerge{
+    public:
+        //stores the result of chunk chunk, then calls merge(chunk, result) for every chunk that is next in order
+        template <class Merge>
+        void add(size_t chunk, Result result, Merge merge){
+            std::lock_guard<std::mutex> lock(m_mutex);
+            m_pending[chunk] = std::move(result);
+            for(auto it = m_pending.begin(); it != m_pending.end() && it->first == m_next; it = m_pending.erase(it), ++m_next){
+                merge(it->first, it->second);
+            }
+        }
 
-    //time 0 rates
-    std::vector<double> init_rates {0.0005, 0.0006, 0.0007, 0.0009, 0.001,0.0016, 0.0023,0.0049,0.0082,0.0115,0.0169, 0.0188};
-    std::vector<double> init_tenors {1.0/12.0, 1.0/6.0, 0.25, 0.5, 1,2,3,5,7,10,20,30};
-    simulationlib::LiborRateSimulation<double> lmm_test{simulation_nums,projection_years, num_time_steps,maturity,
-                                                        rate_freq, init_rates, init_tenors};
+    private:
+        std::mutex m_mutex;
+        std::map<size_t, Result> m_pending;
+        size_t m_next = 0;
+    };
 
-    //set vol assumption
-    double a = 0.19, b = 0.97, c = 0.08, d = 0.01;
-    lmm_test.setVol(a, b, c, d);
 
-    //set correlation assumption
-    double rho_inf = 0.99, lambda = 0.5, kai = 0.5;
-    lmm_test.setCorr(rho_inf, lambda, kai);
+    template <class T>
+    struct PathView{//what a reducer sees of one simulated path
+        size_t path;//path index in [0, simulation_nums)
+        const T* forwards;//terminal Libor rates
+        size_t num_rates;
+        size_t stride = 1;//distance between consecutive rates, paths simulated in SIMD lanes are interleaved
+        bool antithetic = false;//paths 2k and 2k+1 use the same shocks with opposite signs
+        const T* controls = nullptr;//drift free forwards driven by the same shocks, set when control variates are on
+        const T* history = nullptr;//rates after every time step, set when a reducer needsHistory()
+        const T* shocks = nullptr;//normals that drove the path, step major
+        const T* discounts = nullptr;//terminal bonds over the numeraire, kept by the path kernel
+        const T* discount_history = nullptr;//the same after every time step, set with history
 
-    //set time 0 rates
-    lmm_test.setInitRate();
+        T forward(size_t j) const{
+            return forwards[j*stride];
+        }
+        T forward(size_t step, size_t j) const{//rate j at the end of time step step
+            return history[(step*num_rates + j)*stride];
+        }
+        T shock(size_t k) const{//normal k = step*shock_num + rate, or + factor with setFactorNum
+            return shocks[k*stride];
+        }
+        T control(size_t j) const{//lognormal martingale with mean equal to the initial forward j
+            return controls[j*stride];
+        }
+        //P(t,T_{j+1})/P(t,T_0) = prod_{k<=j} 1/(1+tau*F_k): the bond to the end of forward j in units of the
+        //numeraire, at the end of the run or of time step step
+        T discount(size_t j) const{
+            return discounts[j*stride];
+        }
+        T discount(size_t step, size_t j) const{
+            return discount_history[(step*num_rates + j)*stride];
+        }
+    };
 
-    //simulation
-    std::vector<std::vector<double>> libor_rates = lmm_test.LiborSimulation();
+    //raw binary checkpoint fields, native byte order
+    template <class V>
+    void writeValue(std::ostream& out, const V& value){
+        out.write(reinterpret_cast<const char*>(&value), sizeof(V));
+    }
+    template <class V>
+    void readValue(std::istream& in, V& value){
+        if(!in.read(reinterpret_cast<char*>(&value), sizeof(V))) throw std::runtime_error("checkpoint is truncated");
+    }
+    template <class V>
+    void writeVector(std::ostream& out, const std::vector<V>& values){
+        writeValue(out, static_cast<uint64_t>(values.size()));
+        out.write(reinterpret_cast<const char*>(values.data()), values.size()*sizeof(V));
+    }
+    //folds the bits of x[0..n) into hash; settings that differ in any bit almost surely give another hash
+    template <class V>
+    uint64_t hashValues(uint64_t hash, const V* x, size_t n){
+        for(size_t k = 0; k < n; ++k){
+            double value = static_cast<double>(x[k]);
+            uint64_t bits;
+            std::memcpy(&bits, &value, sizeof(bits));
+            uint64_t state = hash ^ bits;
+            hash = splitMix(state);
+        }
+        return hash;
+    }
+    template <class V>
+    void readVector(std::istream& in, std::vector<V>& values){//values must already have the saved size
+        uint64_t size;
+        readValue(in, size);
+        if(size != values.size()) throw std::runtime_error("checkpoint does not match the reducer settings");
+        if(!in.read(reinterpret_cast<char*>(values.data()), size*sizeof(V))) throw std::runtime_error("checkpoint is truncated");
+    }
 
+    template <class T>
+    class PathReducer{//consumes paths as they are produced, so no path has to be stored
+    public:
+        virtual ~PathReducer() = default;
+        virtual void observePath(const PathView<T>& path) = 0;
+        virtual void merge(const PathReducer<T>& other) = 0;//other is an accumulated clone()
+        virtual std::unique_ptr<PathReducer<T>> clone() const = 0;//empty reducer with the same settings
+        virtual void save(std::ostream& out) const = 0;//accumulated state for checkpoints
+        virtual void load(std::istream& in) = 0;//replaces the state, settings stay those of the constructor
+        virtual bool needsHistory() const{//true if observePath reads the rates of intermediate steps
+            return false;
+        }
+    };
 
-    int rate_index = 3;
-    std::vector<int> vol_tenors{3,3,3};
-    double error = lmm_test.validateVol(rate_index, vol_tenors);
-    return 1;
-}
\ No newline at end of file
+    template <class T>
+    class MeanReducer : public PathReducer<T>{//mean of every terminal rate
+    public:
+        explicit MeanReducer(size_t num_rates):m_sum(num_rates, 0.0){};
+
+        void observePath(const PathView<T>& path) override{
+            for(size_t j = 0; j < m_sum.size(); ++j) m_sum[j] += path.forward(j);
+            ++m_count;
+        }
+        void merge(const PathReducer<T>& other) override{
+            const MeanReducer<T>& o = dynamic_cast<const MeanReducer<T>&>(other);
+            for(size_t j = 0; j < m_sum.size(); ++j) m_sum[j] += o.m_sum[j];
+            m_count += o.m_count;
+        }
+        std::unique_ptr<PathReducer<T>> clone() const override{
+            return std::unique_ptr<PathReducer<T>>(new MeanReducer<T>(m_sum.size()));
+        }
+        void save(std::ostream& out) const override{
+            writeVector(out, m_sum);
+            writeValue(out, m_count);
+        }
+        void load(std::istream& in) override{
+            readVector(in, m_sum);
+            readValue(in, m_count);
+        }
+
+        double mean(size_t j) const{
+            return m_count ? m_sum[j]/m_count : 0.0;
+        }
+        size_t count() const{
+            return m_count;
+        }
+    private:
+        std::vector<double> m_sum;
+        size_t m_count = 0;
+    };
+
+    template <class T>
+    class VarianceReducer : public PathReducer<T>{//Welford mean/variance of every terminal rate (or its log)
+    public:
+        VarianceReducer(size_t num_rates, bool log_rates = false)
+        :m_log_rates(log_rates),m_mean(num_rates, 0.0),m_m2(num_rates, 0.0){};
+
+        void observePath(const PathView<T>& path) override{
+            ++m_count;
+            for(size_t j = 0; j < m_mean.size(); ++j){
+                double x = m_log_rates ? log(path.forward(j)) : path.forward(j);
+                double delta = x - m_mean[j];
+                m_mean[j] += delta/m_count;
+                m_m2[j] += delta*(x - m_mean[j]);
+            }
+        }
+        void merge(const PathReducer<T>& other) override{//Chan et al. pairwise update
+            const VarianceReducer<T>& o = dynamic_cast<const VarianceReducer<T>&>(other);
+            if(o.m_count == 0) return;
+            double n = m_count + o.m_count;
+            for(size_t j = 0; j < m_mean.size(); ++j){
+                double delta = o.m_mean[j] - m_mean[j];
+                m_mean[j] += delta*o.m_count/n;
+                m_m2[j] += o.m_m2[j] + delta*delta*m_count*o.m_count/n;
+            }
+            m_count += o.m_count;
+        }
+        std::unique_ptr<PathReducer<T>> clone() const override{
+            return std::unique_ptr<PathReducer<T>>(new VarianceReducer<T>(m_mean.size(), m_log_rates));
+        }
+        void save(std::ostream& out) const override{
+            writeVector(out, m_mean);
+            writeVector(out, m_m2);
+            writeValue(out, m_count);
+        }
+        void load(std::istream& in) override{
+            readVector(in, m_mean);
+            readVector(in, m_m2);
+            readValue(in, m_count);
+        }
+
+        double mean(size_t j) const{
+            return m_mean[j];
+        }
+        double variance(size_t j) const{//unbiased sample variance
+            return m_count > 1 ? m_m2[j]/(m_count-1) : 0.0;
+        }
+        double stdError(size_t j) const{//of the mean, for independent paths
+            return m_count > 1 ? sqrt(variance(j)/m_count) : 0.0;
+        }
+        size_t count() const{
+            return m_count;
+        }
+    private:
+        bool m_log_rates;
+        std::vector<double> m_mean;
+        std::vector<double> m_m2;
+        size_t m_count = 0;
+    };
+
+    template <class T>
+    class HistogramReducer : public PathReducer<T>{//distribution of one terminal rate on equal width bins
+    public:
+        HistogramReducer(size_t rate_index, double lower, double upper, size_t bin_num)
+        :m_rate_index(rate_index),m_lower(lower),m_upper(upper),m_bins(bin_num, 0){};
+
+        void observePath(const PathView<T>& path) override{
+            double x = path.forward(m_rate_index);
+            if(std::isnan(x)) ++m_nan;
+            else if(x < m_lower) ++m_underflow;
+            else if(x >= m_upper) ++m_overflow;
+            else{//just below upper the scaled offset can round up to the bin number
+                size_t bin = static_cast<size_t>((x - m_lower)/(m_upper - m_lower)*m_bins.size());
+                ++m_bins[std::min(bin, m_bins.size() - 1)];
+            }
+        }
+        void merge(const PathReducer<T>& other) override{
+            const HistogramReducer<T>& o = dynamic_cast<const HistogramReducer<T>&>(other);
+            for(size_t b = 0; b < m_bins.size(); ++b) m_bins[b] += o.m_bins[b];
+            m_underflow += o.m_underflow;
+            m_overflow += o.m_overflow;
+            m_nan += o.m_nan;
+        }
+        std::unique_ptr<PathReducer<T>> clone() const override{
+            return std::unique_ptr<PathReducer<T>>(new HistogramReducer<T>(m_rate_index, m_lower, m_upper, m_bins.size()));
+        }
+        void save(std::ostream& out) const override{
+            writeVector(out, m_bins);
+            writeValue(out, m_underflow);
+            writeValue(out, m_overflow);
+            writeValue(out, m_nan);
+        }
+        void load(std::istream& in) override{
+            readVector(in, m_bins);
+            readValue(in, m_underflow);
+            readValue(in, m_overflow);
+            readValue(in, m_nan);
+        }
+
+        const std::vector<size_t>& bins() const{
+            return m_bins;
+        }
+        size_t underflow() const{
+            return m_underflow;
+        }
+        size_t overflow() const{
+            return m_overflow;
+        }
+        size_t nanCount() const{//paths whose rate is not a number, in no bin
+            return m_nan;
+        }
+    private:
+        size_t m_rate_index;
+        double m_lower;
+        double m_upper;
+        std::vector<size_t> m_bins;
+        size_t m_underflow = 0;
+        size_t m_overflow = 0;
+        size_t m_nan = 0;
+    };
+
+    template <class T>
+    class CurveStatsReducer : public PathReducer<T>{//moments of every rate and its log at every time step, one pass
+    public:
+        CurveStatsReducer(size_t num_steps, size_t num_rates)
+        :m_num_steps(num_steps),m_num_rates(num_rates),m_mean(num_steps*num_rates, 0.0),m_m2(m_mean.size(), 0.0),
+        m_m3(m_mean.size(), 0.0),m_log_mean(m_mean.size(), 0.0),m_log_m2(m_mean.size(), 0.0){};
+
+        void observePath(const PathView<T>& path) override{//Welford update extended to the third moment
+            ++m_count;
+            const double n = m_count, inv_n = 1.0/n;
+            for(size_t i = 0; i < m_num_steps; ++i){
+                for(size_t j = 0; j < m_num_rates; ++j){
+                    size_t k = i*m_num_rates + j;
+                    double x = path.forward(i, j);
+                    double delta = x - m_mean[k], delta_n = delta*inv_n;
+                    double term = delta*delta_n*(n - 1);
+                    m_mean[k] += delta_n;
+                    m_m3[k] += term*delta_n*(n - 2) - 3*delta_n*m_m2[k];
+                    m_m2[k] += term;
+                    double y = log(x);
+                    double log_delta = y - m_log_mean[k];
+                    m_log_mean[k] += log_delta*inv_n;
+                    m_log_m2[k] += log_delta*(y - m_log_mean[k]);
+                }
+            }
+        }
+        void merge(const PathReducer<T>& other) override{//Chan et al. pairwise update
+            const CurveStatsReducer<T>& o = dynamic_cast<const CurveStatsReducer<T>&>(other);
+            if(o.m_count == 0) return;
+            const double na = m_count, nb = o.m_count, n = na + nb;
+            for(size_t k = 0; k < m_mean.size(); ++k){
+                double delta = o.m_mean[k] - m_mean[k];
+                m_m3[k] += o.m_m3[k] + delta*delta*delta*na*nb*(na - nb)/(n*n) + 3*delta*(na*o.m_m2[k] - nb*m_m2[k])/n;
+                m_m2[k] += o.m_m2[k] + delta*delta*na*nb/n;
+                m_mean[k] += delta*nb/n;
+                double log_delta = o.m_log_mean[k] - m_log_mean[k];
+                m_log_m2[k] += o.m_log_m2[k] + log_delta*log_delta*na*nb/n;
+                m_log_mean[k] += log_delta*nb/n;
+            }
+            m_count += o.m_count;
+        }
+        std::unique_ptr<PathReducer<T>> clone() const override{
+            return std::unique_ptr<PathReducer<T>>(new CurveStatsReducer<T>(m_num_steps, m_num_rates));
+        }
+        void save(std::ostream& out) const override{
+            for(const std::vector<double>* moments : {&m_mean, &m_m2, &m_m3, &m_log_mean, &m_log_m2}) writeVector(out, *moments);
+            writeValue(out, m_count);
+        }
+        void load(std::istream& in) override{
+            for(std::vector<double>* moments : {&m_mean, &m_m2, &m_m3, &m_log_mean, &m_log_m2}) readVector(in, *moments);
+            readValue(in, m_count);
+        }
+        bool needsHistory() const override{
+            return true;
+        }
+
+        double mean(size_t step, size_t j) const{
+            return m_mean[step*m_num_rates + j];
+        }
+        double variance(size_t step, size_t j) const{//unbiased sample variance
+            return m_count > 1 ? m_m2[step*m_num_rates + j]/(m_count-1) : 0.0;
+        }
+        double skewness(size_t step, size_t j) const{//sample skewness g1
+            size_t k = step*m_num_rates + j;
+            return m_m2[k] > 0 ? sqrt(double(m_count))*m_m3[k]/pow(m_m2[k], 1.5) : 0.0;
+        }
+        double logMean(size_t step, size_t j) const{
+            return m_log_mean[step*m_num_rates + j];
+        }
+        double logVariance(size_t step, size_t j) const{//unbiased sample variance of the log rate
+            return m_count > 1 ? m_log_m2[step*m_num_rates + j]/(m_count-1) : 0.0;
+        }
+        size_t count() const{
+            return m_count;
+        }
+        size_t numSteps() const{
+            return m_num_steps;
+        }
+        size_t numRates() const{
+            return m_num_rates;
+        }
+    private:
+        size_t m_num_steps;
+        size_t m_num_rates;
+        std::vector<double> m_mean;
+        std::vector<double> m_m2;
+        std::vector<double> m_m3;
+        std::vector<double> m_log_mean;
+        std::vector<double> m_log_m2;
+        size_t m_count = 0;
+    };
+
+    struct RunningMoments{//Welford mean and second moment with Chan et al. pairwise merge
+        size_t count = 0;
+        double mean = 0.0;
+        double m2 = 0.0;
+
+        void add(double x){
+            ++count;
+            double delta = x - mean;
+            mean += delta/count;
+            m2 += delta*(x - mean);
+        }
+        void merge(const RunningMoments& o){
+            if(o.count == 0) return;
+            double n = count + o.count;
+            double delta = o.mean - mean;
+            mean += delta*o.count/n;
+            m2 += o.m2 + delta*delta*count*o.count/n;
+            count += o.count;
+        }
+        double variance() const{//unbiased sample variance
+            return count > 1 ? m2/(count-1) : 0.0;
+        }
+    };
+
+    //moments of one estimate over every path and over its independent samples: the paths, or with antithetic
+    //pairs, which reach a reducer back to back, the average of each pair
+    struct SampleMoments{
+        RunningMoments path;
+        RunningMoments sample;
+        double pending = 0.0;//first value of an open pair
+
+        template <class T>
+        void add(double x, const PathView<T>& view){
+            path.add(x);
+            if(!view.antithetic) sample.add(x);
+            else if(view.path % 2 == 0) pending = x;
+            else sample.add(0.5*(pending + x));
+        }
+        void merge(const SampleMoments& o){
+            path.merge(o.path);
+            sample.merge(o.sample);
+        }
+        double mean() const{
+            return path.mean;
+        }
+        double stdError() const{
+            return sample.count > 1 ? sqrt(sample.variance()/sample.count) : 0.0;
+        }
+    };
+
+    template <class T>
+    class PayoffReducer : public PathReducer<T>{//Monte Carlo estimate of a user payoff on the terminal rates
+    public:
+        explicit PayoffReducer(std::function<double(const PathView<T>&)> payoff):m_payoff(payoff){};
+
+        void observePath(const PathView<T>& path) override{
+            m_moments.add(m_payoff(path), path);
+        }
+        void merge(const PathReducer<T>& other) override{
+            const PayoffReducer<T>& o = dynamic_cast<const PayoffReducer<T>&>(other);
+            m_moments.merge(o.m_moments);
+        }
+        std::unique_ptr<PathReducer<T>> clone() const override{
+            return std::unique_ptr<PathReducer<T>>(new PayoffReducer<T>(m_payoff));
+        }
+        void save(std::ostream& out) const override{
+            writeValue(out, m_moments);
+        }
+        void load(std::istream& in) override{
+            readValue(in, m_moments);
+        }
+
+        double mean() const{
+            return m_moments.mean();
+        }
+        double stdError() const{//from the independent samples, antithetic pairs count as one
+            return m_moments.stdError();
+        }
+        double varianceReduction() const{//variance of plain sampling over the achieved one for the same path number
+            double achieved = stdError()*stdError()*m_moments.path.count;
+            return achieved > 0 ? m_moments.path.variance()/achieved : 1.0;
+        }
+    private:
+        std::function<double(const PathView<T>&)> m_payoff;
+        SampleMoments m_moments;
+    };
+
+    template <class T>
+    class ControlVariateReducer : public PathReducer<T>{//payoff estimate corrected by a control with known mean
+    public:
+        ControlVariateReducer(std::function<double(const PathView<T>&)> payoff,
+                              std::function<double(const PathView<T>&)> control, double control_mean)
+        :m_payoff(payoff),m_control(control),m_control_mean(control_mean){};
+
+        void observePath(const PathView<T>& path) override{
+            double y = m_payoff(path), x = m_control(path);
+            ++m_path_count;
+            if(!path.antithetic) add(y, x);
+            else if(path.path % 2 == 0){
+                m_pending_y = y;
+                m_pending_x = x;
+            }
+            else add(0.5*(m_pending_y + y), 0.5*(m_pending_x + x));
+        }
+        void merge(const PathReducer<T>& other) override{
+            const ControlVariateReducer<T>& o = dynamic_cast<const ControlVariateReducer<T>&>(other);
+            m_path_count += o.m_path_count;
+            if(o.m_y.count == 0) return;
+            double n = m_y.count + o.m_y.count;
+            m_cov += o.m_cov + (o.m_x.mean - m_x.mean)*(o.m_y.mean - m_y.mean)*m_y.count*o.m_y.count/n;
+            m_y.merge(o.m_y);
+            m_x.merge(o.m_x);
+        }
+        std::unique_ptr<PathReducer<T>> clone() const override{
+            return std::unique_ptr<PathReducer<T>>(new ControlVariateReducer<T>(m_payoff, m_control, m_control_mean));
+        }
+        void save(std::ostream& out) const override{
+            writeValue(out, m_y);
+            writeValue(out, m_x);
+            writeValue(out, m_path_count);
+            for(double x : {m_cov, m_pending_y, m_pending_x}) writeValue(out, x);
+        }
+        void load(std::istream& in) override{
+            readValue(in, m_y);
+            readValue(in, m_x);
+            readValue(in, m_path_count);
+            for(double* x : {&m_cov, &m_pending_y, &m_pending_x}) readValue(in, *x);
+        }
+
+        double beta() const{
+            return m_x.m2 > 0 ? m_cov/m_x.m2 : 0.0;
+        }
+        double mean() const{//control variate estimate
+            return m_y.mean - beta()*(m_x.mean - m_control_mean);
+        }
+        double plainMean() const{
+            return m_y.mean;
+        }
+        double stdError() const{
+            if(m_y.count < 3) return 0.0;
+            double residual = std::max(m_y.m2 - beta()*m_cov, 0.0)/(m_y.count - 2);
+            return sqrt(residual/m_y.count);
+        }
+        double varianceReduction() const{//1/(1-rho^2), the share of payoff variance the control leaves
+            double residual = m_y.m2 - beta()*m_cov;
+            return residual > 0 ? m_y.m2/residual : 1.0;
+        }
+        size_t pathCount() const{
+            return m_path_count;
+        }
+    private:
+        void add(double y, double x){
+            double dx = x - m_x.mean;
+            m_y.add(y);
+            m_x.add(x);
+            m_cov += dx*(y - m_y.mean);
+        }
+
+        std::function<double(const PathView<T>&)> m_payoff;
+        std::function<double(const PathView<T>&)> m_control;
+        double m_control_mean;
+        RunningMoments m_y, m_x;//payoff and control over the independent samples
+        size_t m_path_count = 0;
+        double m_cov = 0.0;//sum of products of payoff and control deviations
+        double m_pending_y = 0.0, m_pending_x = 0.0;
+    };
+
+    //Prices caps, floors and swaptions together from the same paths, deflating each payoff at its fixing step by
+    //the numeraire of the simulation measure: the zero bond to the start of the first forward, so that
+    //P(t,T_{j+1})/P(t,T_0) = prod_{k<=j} 1/(1+tau*F_k(t)) with T_j the end of forward j. Built by
+    //LiborRateSimulation::pricingReducer(), which knows the time grid.
+    template <class T>
+    class PricingReducer : public PathReducer<T>{
+    public:
+        enum class Type{Cap, Floor, PayerSwaption, ReceiverSwaption};
+        static const size_t NO_FIXING = size_t(-1);//forward fixes before the first step or after the last
+
+        PricingReducer(double rate_freq, std::vector<size_t> fixing_steps, double numeraire0)
+        :m_rate_freq(rate_freq),m_fixing_steps(fixing_steps),m_numeraire0(numeraire0){};
+
+        //forwards first_rate to end_rate-1 (0 based); caplets fix on their own, a swaption fixes with first_rate;
+        //returns the instrument index
+        size_t addCap(double strike, size_t first_rate, size_t end_rate, double notional = 1.0){
+            return add(Type::Cap, strike, first_rate, end_rate, notional);
+        }
+        size_t addFloor(double strike, size_t first_rate, size_t end_rate, double notional = 1.0){
+            return add(Type::Floor, strike, first_rate, end_rate, notional);
+        }
+        size_t addPayerSwaption(double strike, size_t first_rate, size_t end_rate, double notional = 1.0){
+            return add(Type::PayerSwaption, strike, first_rate, end_rate, notional);
+        }
+        size_t addReceiverSwaption(double strike, size_t first_rate, size_t end_rate, double notional = 1.0){
+            return add(Type::ReceiverSwaption, strike, first_rate, end_rate, notional);
+        }
+
+        void observePath(const PathView<T>& path) override{
+            for(size_t i = 0; i < m_instruments.size(); ++i){
+                m_moments[i].add(m_numeraire0*value(m_instruments[i], path), path);
+            }
+        }
+        void merge(const PathReducer<T>& other) override{
+            const PricingReducer<T>& o = dynamic_cast<const PricingReducer<T>&>(other);
+            for(size_t i = 0; i < m_instruments.size(); ++i) m_moments[i].merge(o.m_moments[i]);
+        }
+        std::unique_ptr<PathReducer<T>> clone() const override{
+            PricingReducer<T>* copy = new PricingReducer<T>(m_rate_freq, m_fixing_steps, m_numeraire0);
+            for(const Instrument& ins : m_instruments) copy->add(ins.type, ins.strike, ins.first_rate, ins.end_rate, ins.notional);
+            return std::unique_ptr<PathReducer<T>>(copy);
+        }
+        void save(std::ostream& out) const override{//the instruments must be added again before load
+            writeVector(out, m_moments);
+        }
+        void load(std::istream& in) override{
+            readVector(in, m_moments);
+        }
+        bool needsHistory() const override{
+            return true;
+        }
+
+        size_t size() const{
+            return m_instruments.size();
+        }
+        double price(size_t i) const{
+            return m_moments[i].mean();
+        }
+        double stdError(size_t i) const{//from the independent samples, antithetic pairs count as one
+            return m_moments[i].stdError();
+        }
+    private:
+        struct Instrument{
+            Type type;
+            double strike;
+            size_t first_rate;
+            size_t end_rate;
+            double notional;
+        };
+
+        size_t add(Type type, double strike, size_t first_rate, size_t end_rate, double notional){
+            if(first_rate >= end_rate || end_rate > m_fixing_steps.size())
+                throw std::runtime_error("instrument rates are outside the simulated curve");
+            bool swaption = type == Type::PayerSwaption || type == Type::ReceiverSwaption;
+            for(size_t j = first_rate; j < (swaption ? first_rate + 1 : end_rate); ++j){//a swaption fixes once
+                if(m_fixing_steps[j] == NO_FIXING) throw std::runtime_error("forward " + std::to_string(j) +
+                                                                            " does not fix on the simulation grid");
+            }
+            m_instruments.push_back(Instrument{type, strike, first_rate, end_rate, notional});
+            m_moments.emplace_back();
+            return m_instruments.size() - 1;
+        }
+
+        double value(const Instrument& ins, const PathView<T>& path) const{//payoff over the numeraire
+            double total = 0.0;
+            if(ins.type == Type::Cap || ins.type == Type::Floor){
+                for(size_t j = ins.first_rate; j < ins.end_rate; ++j){//caplet j pays at the end of forward j
+                    size_t step = m_fixing_steps[j];
+                    double F = path.forward(step, j);
+                    double payoff = ins.type == Type::Cap ? F - ins.strike : ins.strike - F;
+                    if(payoff > 0) total += m_rate_freq*payoff*deflator(path, step, j);
+                }
+            }
+            else{
+                size_t step = m_fixing_steps[ins.first_rate];
+                double swap = 0.0;
+                for(size_t j = ins.first_rate; j < ins.end_rate; ++j){
+                    swap += m_rate_freq*(path.forward(step, j) - ins.strike)*deflator(path, step, j);
+                }
+                total = std::max(ins.type == Type::PayerSwaption ? swap : -swap, 0.0);
+            }
+            return ins.notional*total;
+        }
+
+        double deflator(const PathView<T>& path, size_t step, size_t j) const{//P(t,T_{j+1})/P(t,T_0) at the step
+            return path.discount(step, j);
+        }
+
+        double m_rate_freq;
+        std::vector<size_t> m_fixing_steps;//step at which each forward fixes
+        double m_numeraire0;//P(0,T_0)
+        std::vector<Instrument> m_instruments;
+        std::vector<SampleMoments> m_moments;//of every instrument
+    };
+
+    template <class T>
+    class ScenarioReducer{//consumes one path under every scenario of LiborRateSimulation::LiborSimulationScenarios
+    public:
+        virtual ~ScenarioReducer() = default;
+        virtual void observeScenarios(const std::vector<PathView<T>>& paths) = 0;//paths[s]: the path under scenario s
+        virtual void merge(const ScenarioReducer<T>& other) = 0;//other is an accumulated clone()
+        virtual std::unique_ptr<ScenarioReducer<T>> clone() const = 0;//empty reducer with the same settings
+        virtual bool needsHistory() const{
+            return false;
+        }
+    };
+
+    //common random number estimate of a payoff under every scenario and of its change from scenario 0; all
+    //scenarios see the same shocks, so the change is estimated path by path with far less noise than two runs
+    template <class T>
+    class ScenarioPayoffReducer : public ScenarioReducer<T>{
+    public:
+        ScenarioPayoffReducer(size_t scenario_num, std::function<double(const PathView<T>&)> payoff, bool needs_history = false)
+        :m_payoff(payoff),m_needs_history(needs_history),m_moments(scenario_num),m_change(scenario_num),
+         m_value(scenario_num, 0.0){};
+
+        void observeScenarios(const std::vector<PathView<T>>& paths) override{
+            for(size_t s = 0; s < m_moments.size(); ++s) m_value[s] = m_payoff(paths[s]);
+            for(size_t s = 0; s < m_moments.size(); ++s){
+                m_moments[s].add(m_value[s], paths[0]);
+                m_change[s].add(m_value[s] - m_value[0], paths[0]);
+            }
+        }
+        void merge(const ScenarioReducer<T>& other) override{
+            const ScenarioPayoffReducer<T>& o = dynamic_cast<const ScenarioPayoffReducer<T>&>(other);
+            for(size_t s = 0; s < m_moments.size(); ++s){
+                m_moments[s].merge(o.m_moments[s]);
+                m_change[s].merge(o.m_change[s]);
+            }
+        }
+        std::unique_ptr<ScenarioReducer<T>> clone() const override{
+            return std::unique_ptr<ScenarioReducer<T>>(new ScenarioPayoffReducer<T>(m_moments.size(), m_payoff, m_needs_history));
+        }
+        bool needsHistory() const override{
+            return m_needs_history;
+        }
+
+        double mean(size_t s) const{
+            return m_moments[s].mean();
+        }
+        double stdError(size_t s) const{//from the independent samples, antithetic pairs count as one
+            return m_moments[s].stdError();
+        }
+        double change(size_t s) const{//mean of payoff(scenario s) - payoff(scenario 0) over the same paths
+            return m_change[s].mean();
+        }
+        double changeStdError(size_t s) const{
+            return m_change[s].stdError();
+        }
+    private:
+        std::function<double(const PathView<T>&)> m_payoff;
+        bool m_needs_history;
+        std::vector<SampleMoments> m_moments;
+        std::vector<SampleMoments> m_change;//of payoff(scenario s) - payoff(scenario 0)
+        std::vector<double> m_value;//payoff of the current path under each scenario
+    };
+
+
+    //eigen decomposition of a symmetric matrix by cyclic Jacobi rotations, eigenvalues sorted descending,
+    //vectors[i][f] is component i of eigenvector f
+    inline void symmetricEigen(std::vector<std::vector<double>> a, std::vector<double>& values,
+                               std::vector<std::vector<double>>& vectors){
+        size_t n = a.size();
+        std::vector<std::vector<double>> v(n, std::vector<double>(n, 0.0));
+        for(size_t i = 0; i < n; ++i) v[i][i] = 1.0;
+        for(int sweep = 0; sweep < 100; ++sweep){
+            double off = 0.0;
+            for(size_t p = 0; p < n; ++p){
+                for(size_t q = p+1; q < n; ++q) off += a[p][q]*a[p][q];
+            }
+            if(off < 1e-30) break;
+            for(size_t p = 0; p < n; ++p){
+                for(size_t q = p+1; q < n; ++q){
+                    if(std::fabs(a[p][q]) < 1e-300) continue;
+                    double theta = (a[q][q] - a[p][p])/(2.0*a[p][q]);
+                    double t = (theta >= 0 ? 1.0 : -1.0)/(std::fabs(theta) + sqrt(theta*theta + 1.0));
+                    double c = 1.0/sqrt(t*t + 1.0), s = t*c;
+                    for(size_t k = 0; k < n; ++k){//A = A*J
+                        double akp = a[k][p], akq = a[k][q];
+                        a[k][p] = c*akp - s*akq;
+                        a[k][q] = s*akp + c*akq;
+                    }
+                    for(size_t k = 0; k < n; ++k){//A = J^T*A
+                        double apk = a[p][k], aqk = a[q][k];
+                        a[p][k] = c*apk - s*aqk;
+                        a[q][k] = s*apk + c*aqk;
+                    }
+                    for(size_t k = 0; k < n; ++k){
+                        double vkp = v[k][p], vkq = v[k][q];
+                        v[k][p] = c*vkp - s*vkq;
+                        v[k][q] = s*vkp + c*vkq;
+                    }
+                }
+            }
+        }
+        std::vector<size_t> order(n);
+        for(size_t i = 0; i < n; ++i) order[i] = i;
+        std::sort(order.begin(), order.end(), [&](size_t x, size_t y){return a[x][x] > a[y][y];});
+        values.assign(n, 0.0);
+        vectors.assign(n, std::vector<double>(n, 0.0));
+        for(size_t f = 0; f < n; ++f){
+            values[f] = a[order[f]][order[f]];
+            for(size_t i = 0; i < n; ++i) vectors[i][f] = v[i][order[f]];
+        }
+    }
+
+    //solves a*x = b by Gaussian elimination with partial pivoting, a is small and dense; false if a is singular
+    inline bool solveLinear(std::vector<std::vector<double>> a, std::vector<double> b, std::vector<double>& x){
+        size_t n = b.size();
+        for(size_t c = 0; c < n; ++c){
+            size_t pivot = c;
+            for(size_t r = c + 1; r < n; ++r){
+                if(std::abs(a[r][c]) > std::abs(a[pivot][c])) pivot = r;
+            }
+            if(a[pivot][c] == 0.0) return false;
+            std::swap(a[c], a[pivot]);
+            std::swap(b[c], b[pivot]);
+            for(size_t r = c + 1; r < n; ++r){
+                double factor = a[r][c]/a[c][c];
+                for(size_t k = c; k < n; ++k) a[r][k] -= factor*a[c][k];
+                b[r] -= factor*b[c];
+            }
+        }
+        x.assign(n, 0.0);
+        for(size_t r = n; r-- > 0;){
+            double sum = b[r];
+            for(size_t k = r + 1; k < n; ++k) sum -= a[r][k]*x[k];
+            x[r] = sum/a[r][r];
+        }
+        return true;
+    }
+
+    struct CalibrationResult{//best parameters found and how well they fit
+        std::vector<double> params;
+        double rms_error = 0.0;//root mean square residual
+        size_t iterations = 0;
+    };
+
+    //Levenberg-Marquardt least squares on box constrained parameters. residuals(params, r, J) fills the residuals r
+    //and their analytic Jacobian J[k][p] = dr_k/dparam_p; several starting points are run on a thread pool
+    class LevenbergMarquardt{
+    public:
+        typedef std::function<void(const std::vector<double>&, std::vector<double>&, std::vector<std::vector<double>>&)>
+                Residuals;
+
+        LevenbergMarquardt(Residuals residuals, std::vector<double> lower, std::vector<double> upper)
+        :m_residuals(residuals),m_lower(lower),m_upper(upper){};
+
+        void setMaxIterations(size_t max_iterations){
+            m_max_iterations = max_iterations;
+        }
+
+        CalibrationResult minimize(std::vector<double> params) const{
+            const size_t p = params.size();
+            project(params);
+            std::vector<double> r, r_try, step;
+            std::vector<std::vector<double>> J, J_try;
+            m_residuals(params, r, J);
+            double cost = sumSquares(r), damping = 1e-3;
+            CalibrationResult result;
+            for(; result.iterations < m_max_iterations; ++result.iterations){
+                std::vector<std::vector<double>> JtJ(p, std::vector<double>(p, 0.0));
+                std::vector<double> Jtr(p, 0.0);
+                for(size_t k = 0; k < r.size(); ++k){
+                    for(size_t i = 0; i < p; ++i){
+                        Jtr[i] -= J[k][i]*r[k];
+                        for(size_t j = 0; j < p; ++j) JtJ[i][j] += J[k][i]*J[k][j];
+                    }
+                }
+                double gain = 0.0;
+                while(gain == 0.0 && damping < 1e12){//raise the damping until a step lowers the cost
+                    std::vector<std::vector<double>> system = JtJ;
+                    for(size_t i = 0; i < p; ++i) system[i][i] += damping*std::max(JtJ[i][i], 1e-12);
+                    if(solveLinear(system, Jtr, step)){
+                        std::vector<double> trial(p);
+                        for(size_t i = 0; i < p; ++i) trial[i] = params[i] + step[i];
+                        project(trial);
+                        m_residuals(trial, r_try, J_try);
+                        double trial_cost = sumSquares(r_try);
+                        if(trial_cost < cost){
+                            gain = cost - trial_cost;
+                            params.swap(trial);
+                            r.swap(r_try);
+                            J.swap(J_try);
+                            cost = trial_cost;
+                            damping = std::max(damping/10, 1e-12);
+                            break;
+                        }
+                    }
+                    damping *= 10;
+                }
+                if(gain <= 1e-15*(cost + gain)) break;//no step helps, or no measurable gain
+            }
+            result.params = params;
+            result.rms_error = r.empty() ? 0.0 : sqrt(cost/r.size());
+            return result;
+        }
+
+        //runs every start in parallel and keeps the lowest error, the first start wins ties
+        CalibrationResult minimize(const std::vector<std::vector<double>>& starts, size_t thread_num) const{
+            std::vector<CalibrationResult> results(starts.size());
+            ThreadPool pool(std::min(thread_num, starts.size()));
+            pool.parallelFor(0, starts.size(), 1, [&](size_t, size_t begin, size_t end){
+                for(size_t s = begin; s < end; ++s) results[s] = minimize(starts[s]);
+            });
+            size_t best = 0;
+            for(size_t s = 1; s < results.size(); ++s){
+                if(results[s].rms_error < results[best].rms_error) best = s;
+            }
+            return results[best];
+        }
+    private:
+        static double sumSquares(const std::vector<double>& r){
+            double sum = 0.0;
+            for(double x : r) sum += x*x;
+            return sum;
+        }
+        void project(std::vector<double>& params) const{
+            for(size_t i = 0; i < params.size(); ++i) params[i] = std::min(std::max(params[i], m_lower[i]), m_upper[i]);
+        }
+
+        Residuals m_residuals;
+        std::vector<double> m_lower;
+        std::vector<double> m_upper;
+        size_t m_max_iterations = 200;
+    };
+
+    struct StepBiasResult{//one line of LiborRateSimulation::stepBiasBenchmark
+        unsigned long step_num;
+        bool predictor_corrector;
+        double max_bias;//largest relative martingale error over the sampled forwards
+        double std_error;//of that error
+        double seconds;
+    };
+
+    struct PrecisionReport{//float run against the double run of the same paths, see LiborRateSimulation::precisionReport
+        size_t path_num;
+        double max_path_error;//largest relative gap of one terminal rate on one path
+        double max_mean_error;//largest relative gap of a terminal rate mean
+        double max_vol_error;//largest relative gap of a terminal rate standard deviation
+        double max_price_error;//largest caplet price gap in standard errors of the double price
+        double double_seconds;
+        double float_seconds;
+    };
+
+    //statistic LiborRateSimulation::LiborSimulationToTarget runs until its standard error is within
+    //max(abs_tol, rel_tol*|value|); both functions read a registered reducer, e.g. a price and its stdError
+    struct StoppingTarget{
+        std::function<double()> value;
+        std::function<double()> std_error;
+        double abs_tol;
+        double rel_tol;
+    };
+
+    struct StoppingReport{//outcome of LiborRateSimulation::LiborSimulationToTarget
+        size_t path_num;
+        size_t batch_num;
+        bool converged;//false if the path limit came first
+        std::vector<double> values;//of every target at the stop
+        std::vector<double> std_errors;
+        std::vector<double> tolerances;
+    };
+
+    //exp by range reduction to |r| <= ln2/2 and a Taylor polynomial, written branch free with integer exponent
+    //construction so loops over SIMD lanes vectorise (std::exp calls do not)
+    __attribute__((always_inline)) inline double simdExp(double x){
+        const double shift = 6755399441055744.0;//1.5*2^52, rounds x/ln2 to an integer held in the low mantissa bits
+        double kd = x*1.4426950408889634 + shift;
+        int64_t k;
+        std::memcpy(&k, &kd, sizeof(k));
+        kd -= shift;
+        double r = x - kd*0.693147180369123816490;
+        r = r - kd*1.90821492927058770002e-10;
+        double p = 1.0/6227020800.0;
+        p = p*r + 1.0/479001600.0;
+        p = p*r + 1.0/39916800.0;
+        p = p*r + 1.0/3628800.0;
+        p = p*r + 1.0/362880.0;
+        p = p*r + 1.0/40320.0;
+        p = p*r + 1.0/5040.0;
+        p = p*r + 1.0/720.0;
+        p = p*r + 1.0/120.0;
+        p = p*r + 1.0/24.0;
+        p = p*r + 1.0/6.0;
+        p = p*r + 0.5;
+        p = p*r + 1.0;
+        p = p*r + 1.0;
+        int64_t n = k - 0x4338000000000000LL;
+        n = n < -1022 ? -1022 : n;//saturate instead of wrapping the exponent bits
+        n = n > 1023 ? 1023 : n;
+        int64_t e = (n + 1023) << 52;
+        double scale;
+        std::memcpy(&scale, &e, sizeof(scale));
+        return p*scale;
+    }
+
+    __attribute__((always_inline)) inline float simdExp(float x){
+        const float shift = 12582912.0f;//1.5*2^23
+        float kf = x*1.44269504f + shift;
+        int32_t k;
+        std::memcpy(&k, &kf, sizeof(k));
+        kf -= shift;
+        float r = x - kf*0.693359375f;
+        r = r + kf*2.12194440e-4f;
+        float p = 1.0f/5040.0f;
+        p = p*r + 1.0f/720.0f;
+        p = p*r + 1.0f/120.0f;
+        p = p*r + 1.0f/24.0f;
+        p = p*r + 1.0f/6.0f;
+        p = p*r + 0.5f;
+        p = p*r + 1.0f;
+        p = p*r + 1.0f;
+        int32_t n = k - 0x4B400000;
+        n = n < -126 ? -126 : n;
+        n = n > 127 ? 127 : n;
+        int32_t e = (n + 127) << 23;
+        float scale;
+        std::memcpy(&scale, &e, sizeof(scale));
+        return p*scale;
+    }
+
+    //where the time of a run goes, see LiborRateSimulation::setProfiling; worker phases add up over threads
+    struct RunProfile{
+        enum Phase{Setup, Shocks, Kernel, Controls, Reducers, Merge, PHASE_NUM};
+
+        std::array<double, PHASE_NUM> seconds{};
+        double wall_seconds = 0.0;
+        size_t thread_num = 0;
+        size_t paths = 0;
+        size_t lane_groups = 0;//kernel calls, lanes paths each
+        size_t chunks = 0;
+        size_t slow_draws = 0;//ziggurat draws outside the rectangles
+        size_t exp_calls = 0;//exponentials taken for the simulated paths, padding lanes left out
+        size_t workspace_bytes = 0;//allocated once per run, before the paths
+        bool hardware = false;//perf_event_open counters below are valid
+        uint64_t cycles = 0;
+        uint64_t instructions = 0;
+        uint64_t cache_misses = 0;
+
+        static const char* phaseName(size_t phase){
+            static const char* names[PHASE_NUM] = {"setup", "shocks", "kernel", "controls", "reducers", "merge"};
+            return names[phase];
+        }
+
+        void add(const RunProfile& o){//per thread counters into the run total
+            for(size_t p = 0; p < PHASE_NUM; ++p) seconds[p] += o.seconds[p];
+            paths += o.paths;
+            lane_groups += o.lane_groups;
+            chunks += o.chunks;
+            slow_draws += o.slow_draws;
+            exp_calls += o.exp_calls;
+            cycles += o.cycles;
+            instructions += o.instructions;
+            cache_misses += o.cache_misses;
+        }
+
+        void report(std::ostream& out) const{//one JSON object
+            double busy = 0.0;
+            for(double t : seconds) busy += t;
+            out<<"{\"paths\": "<<paths<<", \"threads\": "<<thread_num<<", \"wall_seconds\": "<<wall_seconds
+            <<", \"paths_per_second\": "<<(wall_seconds > 0 ? paths/wall_seconds : 0.0)<<", \"phases\": {";
+            for(size_t p = 0; p < PHASE_NUM; ++p){
+                out<<(p ? ", " : "")<<"\""<<phaseName(p)<<"\": {\"seconds\": "<<seconds[p]
+                <<", \"share\": "<<(busy > 0 ? seconds[p]/busy : 0.0)<<"}";
+            }
+            out<<"}, \"lane_groups\": "<<lane_groups<<", \"chunks\": "<<chunks<<", \"slow_draws\": "<<slow_draws
+            <<", \"exp_calls\": "<<exp_calls<<", \"kernel_ns_per_exp_call\": "
+            <<(exp_calls ? seconds[Kernel]/exp_calls*1e9 : 0.0)<<", \"workspace_bytes\": "<<workspace_bytes;
+            if(hardware){
+                out<<", \"cycles\": "<<cycles<<", \"instructions\": "<<instructions<<", \"cache_misses\": "<<cache_misses
+                <<", \"cycles_per_path\": "<<(paths ? double(cycles)/paths : 0.0);
+            }
+            out<<"}"<<std::endl;
+        }
+    };
+
+    class ScopedPhase{//adds its lifetime to a phase of profile; a null profile costs one branch
+    public:
+        ScopedPhase(RunProfile* profile, RunProfile::Phase phase):m_profile(profile),m_phase(phase){
+            if(m_profile) m_start = std::chrono::steady_clock::now();
+        }
+        ~ScopedPhase(){
+            if(m_profile) m_profile->seconds[m_phase] += std::chrono::duration<double>(std::chrono::steady_clock::now() - m_start).count();
+        }
+        ScopedPhase(const ScopedPhase&) = delete;
+        ScopedPhase& operator=(const ScopedPhase&) = delete;
+    private:
+        RunProfile* m_profile;
+        RunProfile::Phase m_phase;
+        std::chrono::steady_clock::time_point m_start;
+    };
+
+    class PerfCounters{//cycles, instructions and cache misses of the calling thread, where the kernel allows it
+    public:
+        PerfCounters(){
+#if defined(__linux__)
+            const uint64_t configs[3] = {PERF_COUNT_HW_CPU_CYCLES, PERF_COUNT_HW_INSTRUCTIONS, PERF_COUNT_HW_CACHE_MISSES};
+            for(int c = 0; c < 3; ++c){
+                perf_event_attr attr;
+                std::memset(&attr, 0, sizeof(attr));
+                attr.size = sizeof(attr);
+                attr.type = PERF_TYPE_HARDWARE;
+                attr.config = configs[c];
+                attr.exclude_kernel = 1;
+                attr.exclude_hv = 1;
+                m_fd[c] = static_cast<int>(syscall(SYS_perf_event_open, &attr, 0, -1, -1, 0));//this thread, any cpu
+                if(m_fd[c] < 0){
+                    closeAll();
+                    return;
+                }
+            }
+#endif
+        }
+        ~PerfCounters(){
+            closeAll();
+        }
+        PerfCounters(const PerfCounters&) = delete;
+        PerfCounters& operator=(const PerfCounters&) = delete;
+
+        bool valid() const{
+            return m_fd[0] >= 0;
+        }
+        void read(uint64_t values[3]) const{//running totals
+            for(int c = 0; c < 3; ++c){
+                values[c] = 0;
+                if(m_fd[c] >= 0 && ::read(m_fd[c], &values[c], sizeof(uint64_t)) != sizeof(uint64_t)) values[c] = 0;
+            }
+        }
+    private:
+        void closeAll(){
+            for(int& fd : m_fd){
+                if(fd >= 0) close(fd);
+                fd = -1;
+            }
+        }
+
+        int m_fd[3] = {-1, -1, -1};
+    };
+
+    class MappedFile{//whole file mapping, read only or read write
+    public:
+        //opens file_name; with size > 0 the file is created or truncated to size bytes and mapped writable
+        MappedFile(const std::string& file_name, size_t size = 0){
+            bool writable = size > 0;
+            m_fd = writable ? open(file_name.c_str(), O_RDWR | O_CREAT | O_TRUNC, 0644) : open(file_name.c_str(), O_RDONLY);
+            if(m_fd < 0) fail("cannot open " + file_name);
+            if(writable){
+                if(ftruncate(m_fd, size) != 0) fail("cannot size " + file_name);
+            }
+            else{
+                struct stat info;
+                if(fstat(m_fd, &info) != 0) fail("cannot stat " + file_name);
+                size = info.st_size;
+            }
+            m_size = size;
+            if(m_size == 0) fail(file_name + " is empty");
+            void* data = mmap(nullptr, m_size, writable ? PROT_READ | PROT_WRITE : PROT_READ, MAP_SHARED, m_fd, 0);
+            if(data == MAP_FAILED) fail("cannot map " + file_name);
+            m_data = static_cast<char*>(data);
+        }
+        ~MappedFile(){
+            if(m_data) munmap(m_data, m_size);
+            if(m_fd >= 0) close(m_fd);
+        }
+        MappedFile(const MappedFile&) = delete;
+        MappedFile& operator=(const MappedFile&) = delete;
+
+        char* data() const{
+            return m_data;
+        }
+        size_t size() const{
+            return m_size;
+        }
+        void sync(){//flush written pages to the file
+            if(msync(m_data, m_size, MS_SYNC) != 0) fail("cannot flush the mapped file");
+        }
+    private:
+        void fail(const std::string& what){
+            std::string message = what + ": " + std::strerror(errno);
+            if(m_data) munmap(m_data, m_size);
+            if(m_fd >= 0) close(m_fd);
+            m_data = nullptr;
+            m_fd = -1;
+            throw std::runtime_error(message);
+        }
+
+        int m_fd = -1;
+        char* m_data = nullptr;
+        size_t m_size = 0;
+    };
+
+    //Path store layout: this header, then step_num step end times and rate_num initial rates as doubles, then
+    //from data_offset (page aligned) one column of path_num values per (step, rate), column step*rate_num+rate.
+    //A column holds one rate at one step for every path, so a reader pages in only the columns it touches.
+    struct PathStoreHeader{
+        char magic[8];//"LMMPATHS"
+        uint32_t version;
+        uint32_t value_bytes;//sizeof(T) of the stored values
+        uint64_t path_num;
+        uint64_t rate_num;
+        uint64_t step_num;//stored steps: every simulation step, or 1 for the terminal rates only
+        uint64_t data_offset;
+        uint64_t seed;//Philox key the paths were drawn with
+        uint32_t seeded;//0 if that key came from random_device
+        uint32_t antithetic;
+        uint32_t shock_source;//ShockSource
+        uint32_t predictor_corrector;
+        uint64_t factor_num;
+        uint64_t time_step_num;//simulation steps
+        double projection_years;
+        double maturity;
+        double rate_freq;
+        double vol_params[4];//a, b, c, d of setVol, unused with a vol surface
+        uint32_t vol_surface;
+        uint32_t reserved;
+        double corr_params[3];//rho_inf, lambda, kai of setCorr
+
+        static const uint32_t VERSION = 1;
+    };
+
+    template <class T>
+    class PathStoreReader{//zero copy views over a path store written by LiborRateSimulation::LiborSimulationToFile
+    public:
+        explicit PathStoreReader(const std::string& file_name):m_file(file_name){
+            if(m_file.size() < sizeof(PathStoreHeader)) throw std::runtime_error(file_name + " is not a path store");
+            std::memcpy(&m_header, m_file.data(), sizeof(PathStoreHeader));
+            if(std::memcmp(m_header.magic, "LMMPATHS", 8) != 0 || m_header.version != PathStoreHeader::VERSION)
+                throw std::runtime_error(file_name + " is not a path store");
+            if(m_header.value_bytes != sizeof(T)) throw std::runtime_error(file_name + " holds values of another type");
+            if(m_file.size() < m_header.data_offset + m_header.path_num*m_header.rate_num*m_header.step_num*sizeof(T))
+                throw std::runtime_error(file_name + " is truncated");
+        }
+
+        const PathStoreHeader& header() const{
+            return m_header;
+        }
+        size_t pathNum() const{
+            return m_header.path_num;
+        }
+        size_t rateNum() const{
+            return m_header.rate_num;
+        }
+        size_t stepNum() const{
+            return m_header.step_num;
+        }
+        const double* stepTimes() const{//end time of every stored step
+            return reinterpret_cast<const double*>(m_file.data() + sizeof(PathStoreHeader));
+        }
+        const double* initRates() const{
+            return stepTimes() + m_header.step_num;
+        }
+        const T* column(size_t step, size_t rate) const{//rate at step for paths 0 to pathNum()-1, no copy
+            return reinterpret_cast<const T*>(m_file.data() + m_header.data_offset) + (step*m_header.rate_num + rate)*m_header.path_num;
+        }
+        const T* terminal(size_t rate) const{
+            return column(m_header.step_num - 1, rate);
+        }
+        T value(size_t path, size_t step, size_t rate) const{
+            return column(step, rate)[path];
+        }
+    private:
+        MappedFile m_file;
+        PathStoreHeader m_header;
+    };
+
+    template <class T>
+    class LiborRateSimulation{
+    public:
+        LiborRateSimulation(int simulation_nums, double projection_years,unsigned long num_time_steps, double maturity,
+                            double rate_freq,std::vector<T> rates, std::vector<T> tenors)
+        :m_simulation_nums(simulation_nums),m_projection_years(projection_years),m_num_time_steps(num_time_steps),m_maturity(maturity),
+         m_rate_freq(rate_freq),m_ri(std::vector<double>(tenors.begin(), tenors.end()), std::vector<double>(rates.begin(), rates.end())),m_init_rates(maturity/rate_freq-1, 0),
+        m_sigma(maturity/rate_freq-1, 0), m_corr(maturity/rate_freq-1, std::vector<T> (maturity/rate_freq-1,0)){
+            m_dt = projection_years/num_time_steps;
+            m_num_rates = maturity/rate_freq-1;
+            for(unsigned long i = 0; i < num_time_steps; ++i) m_step_times.push_back((i+1)*m_dt);
+        };
+
+        //the setup of other in precision T with simulation_nums paths: curve, model, time grid and run settings,
+        //no reducers. LiborRateSimulation<float>(simulation, n) is the mixed precision mode: rates, shocks, tables
+        //and the path kernel in float, half the memory traffic and twice the SIMD lanes, while the reducers still
+        //accumulate statistics and payoffs in double.
+        template <class U>
+        LiborRateSimulation(const LiborRateSimulation<U>& other, int simulation_nums)
+        :m_ri(other.m_ri),m_simulation_nums(simulation_nums),m_projection_years(other.m_projection_years),
+         m_num_time_steps(other.m_num_time_steps),m_dt(other.m_dt),m_step_times(other.m_step_times),
+         m_predictor_corrector(other.m_predictor_corrector),m_maturity(other.m_maturity),m_rate_freq(other.m_rate_freq),
+         m_num_rates(other.m_num_rates),m_thread_num(other.m_thread_num),m_seed(other.m_seed),m_seeded(other.m_seeded),
+         m_init_rates(other.m_init_rates.begin(), other.m_init_rates.end()),
+         m_sigma(other.m_sigma.begin(), other.m_sigma.end()),m_vol_params(other.m_vol_params),
+         m_corr_params(other.m_corr_params),m_vol_surface(other.m_vol_surface),m_drift_tol(other.m_drift_tol),
+         m_factor_num(other.m_factor_num),m_simd_level(other.m_simd_level),m_shock_source(other.m_shock_source),
+         m_antithetic(other.m_antithetic),m_control_variates(other.m_control_variates){
+            for(const auto& row : other.m_corr) m_corr.emplace_back(row.begin(), row.end());
+        }
+
+        void setInitRate(){//get initial rates from time 0 rate curve
+            std::vector<double> tenors(m_num_rates + 1), rates(m_num_rates + 1);//one batch query, start of rate 1 onwards
+            for(int i = 0; i <= m_num_rates; ++i) tenors[i] = m_rate_freq*(i+1);
+            m_ri.getRates(tenors.data(), rates.data(), tenors.size());
+            for(int i = 1; i <= m_num_rates;++i){//same as m_ri.getRate(m_rate_freq*i,m_rate_freq*i+m_rate_freq)
+                double t1 = tenors[i-1], t2 = tenors[i];
+                m_init_rates[i-1] = (rates[i]*t2-rates[i-1]*t1)/(t2-t1);
+            }
+        }
+
+        void setCorr(double rho_inf, double lambda, double kai){
+            for(int i = 1; i <= m_num_rates;++i){
+                for(int j = 1; j <= m_num_rates;++j){
+                    m_corr[i-1][j-1] = rho_inf+(1-rho_inf)*
+                            exp(-lambda*abs(i*m_rate_freq-j*m_rate_freq)/(1+kai*std::min(i*m_rate_freq,j*m_rate_freq)));
+                }
+            }
+            m_corr_params = {rho_inf, lambda, kai};
+            m_corr_factor_num = 0;
+            m_prepared = false;
+        }
+        T getCorr(int i, int j){
+            return m_corr[i-1][j-1];
+        }
+
+
+        void setVol(double a, double b, double c, double d){
+            for(int i = 1; i <= m_num_rates;++i){//this vol form allows a humped shape of instantaneous volatility
+                m_sigma[i-1] = (a*(i*m_rate_freq)+d)*exp(-b*(i*m_rate_freq))+c;
+            }
+            m_vol_params = {a, b, c, d};
+            m_vol_surface = nullptr;
+            m_prepared = false;
+        }
+
+        //time dependent vol: vol_surface(t, tenor) is the vol of the rate fixing at tenor over the step starting at t
+        void setVolSurface(std::function<double(double, double)> vol_surface){
+            m_vol_surface = vol_surface;
+            m_prepared = false;
+        }
+
+        T getVol(double t){
+            return m_sigma[t/m_rate_freq-1];
+        }
+
+        T validateVol(int rate_index, std::vector<int> vol_tenors){
+            //Target Variance
+            T target_var = 0.0;
+            for(int i = 0; i < vol_tenors.size(); ++i){//loop all the vol_tenors
+                target_var+=getVol(vol_tenors[i]*m_rate_freq)*getVol(vol_tenors[i]*m_rate_freq)*m_dt;
+            }
+
+            //Calculated Variance
+            RunningMoments log_rates;
+            for(size_t i = 0; i < m_simulation_nums; ++i){//number of simulation
+                log_rates.add(log(m_output[i][rate_index-1]));
+            }
+            T calc_var = log_rates.variance();
+
+            T test_stat = (m_simulation_nums-1)*sqrt(calc_var/target_var);//Test Statistic
+            
+            std::cout<<"Test Statistic: "<<test_stat<<", Degree of Freedom: "<<m_simulation_nums-1<<std::endl;
+            std::cout<<"Calculated Variance: "<<calc_var<<", Target Variance: "<<target_var
+            <<", ABS Error: "<<abs(calc_var-target_var)<<", Percentage Error: "<<calc_var/target_var - 1.0<<std::endl;
+            if(m_profiling) m_profile.report(std::cout);
+
+            return calc_var/target_var - 1.0;
+        }
+
+        //compares the log variance of every rate at every step with the integrated model variance, returns the
+        //relative error of each rate at the last step; stats come from a CurveStatsReducer fed by LiborSimulationStream
+        std::vector<T> validateVol(const CurveStatsReducer<T>& stats){
+            if(!m_prepared) prepare();
+            const size_t n = m_num_rates;
+            std::vector<T> target_var(n, 0.0), errors(n, 0.0);
+            T worst = 0.0;
+            size_t worst_step = 0, worst_rate = 0;
+            for(size_t i = 0; i < stats.numSteps(); ++i){
+                for(size_t j = 0; j < n; ++j){
+                    target_var[j] += m_vol_sqrt_dt[i*n+j]*m_vol_sqrt_dt[i*n+j];
+                    T error = stats.logVariance(i, j)/target_var[j] - 1.0;
+                    if(std::abs(error) > std::abs(worst)){
+                        worst = error;
+                        worst_step = i;
+                        worst_rate = j;
+                    }
+                    if(i + 1 == stats.numSteps()) errors[j] = error;
+                }
+            }
+            size_t last = stats.numSteps() - 1;
+            for(size_t j = 0; j < n; ++j){
+                std::cout<<"Rate "<<j+1<<": Mean: "<<stats.mean(last, j)<<", Skew: "<<stats.skewness(last, j)
+                <<", Calculated Variance: "<<stats.logVariance(last, j)<<", Target Variance: "<<target_var[j]
+                <<", Percentage Error: "<<errors[j]<<std::endl;
+            }
+            std::cout<<"Paths: "<<stats.count()<<", Worst Percentage Error: "<<worst<<" (rate "<<worst_rate+1
+            <<", step "<<worst_step+1<<")"<<std::endl;
+            if(m_profiling) m_profile.report(std::cout);
+            return errors;
+        }
+
+        //reducer pricing on the simulated curve; forward j fixes at the last step not after its start (j+1)*rate_freq,
+        //see fixingTimeGrid for a grid that lands on every fixing
+        PricingReducer<T> pricingReducer(){
+            std::vector<size_t> fixing_steps(m_num_rates, size_t(PricingReducer<T>::NO_FIXING));
+            for(int j = 0; j < m_num_rates; ++j){
+                double fixing = (j+1)*m_rate_freq;
+                if(fixing > m_step_times.back() + 1e-9) continue;
+                size_t steps = std::upper_bound(m_step_times.begin(), m_step_times.end(), fixing + 1e-9) - m_step_times.begin();
+                if(steps >= 1) fixing_steps[j] = steps - 1;
+            }
+            return PricingReducer<T>(m_rate_freq, fixing_steps, exp(-m_ri.getRate(m_rate_freq)*m_rate_freq));
+        }
+
+        //mean of PathView::discount(j), the bond to the end of forward j in numeraire units: P(0,T_{j+1})/P(0,T_0)
+        double discountMean(size_t j) const{
+            double bond = 1.0;
+            for(size_t k = 0; k <= j; ++k) bond /= 1 + m_rate_freq*m_init_rates[k];
+            return bond;
+        }
+
+        //payoff estimate with PathView::discount(j) as control, whose mean discountMean(j) follows from the initial
+        //curve; the control is exact up to the time step bias stepBiasBenchmark measures
+        ControlVariateReducer<T> bondControlReducer(std::function<double(const PathView<T>&)> payoff, size_t j) const{
+            if(j >= static_cast<size_t>(m_num_rates)) throw std::runtime_error("no forward " + std::to_string(j));
+            return ControlVariateReducer<T>(payoff, [j](const PathView<T>& path){return double(path.discount(j));}, discountMean(j));
+        }
+
+        //fits a, b, c, d of setVol to caplet vols: a caplet expiring at T on the forward starting at T has the
+        //variance validateVol targets, (vol(T))^2*T, so its implied vol is (a*T+d)*exp(-b*T)+c with no simulation.
+        //Sets the fitted vol and returns it.
+        CalibrationResult calibrateVol(const std::vector<double>& expiries, const std::vector<double>& caplet_vols){
+            if(caplet_vols.empty() || expiries.size() != caplet_vols.size()){
+                throw std::runtime_error("calibrateVol needs one caplet vol per expiry");
+            }
+            LevenbergMarquardt lm([&](const std::vector<double>& x, std::vector<double>& r, std::vector<std::vector<double>>& J){
+                r.resize(expiries.size());
+                J.assign(expiries.size(), std::vector<double>(4, 0.0));
+                for(size_t k = 0; k < expiries.size(); ++k){
+                    double t = expiries[k], e = exp(-x[1]*t);
+                    r[k] = (x[0]*t + x[3])*e + x[2] - caplet_vols[k];
+                    J[k] = {t*e, -t*(x[0]*t + x[3])*e, 1.0, e};
+                }
+            }, {-10.0, 0.0, 0.0, -10.0}, {10.0, 10.0, 10.0, 10.0});
+            std::vector<std::vector<double>> starts;
+            for(double b : {0.1, 0.5, 1.0, 2.0}){
+                for(double a : {0.0, 0.2}) starts.push_back({a, b, caplet_vols.back(), caplet_vols.front() - caplet_vols.back()});
+            }
+            CalibrationResult result = lm.minimize(starts, calibrationThreadNum(starts.size()));
+            setVol(result.params[0], result.params[1], result.params[2], result.params[3]);
+            return result;
+        }
+
+        //fits rho_inf, lambda, kai of setCorr to target_corr[i][j], the correlation of the forwards starting at
+        //tenors[i] and tenors[j]; sets the fitted correlation and returns it
+        CalibrationResult calibrateCorr(const std::vector<double>& tenors, const std::vector<std::vector<double>>& target_corr){
+            if(tenors.size() < 2) throw std::runtime_error("calibrateCorr needs at least two tenors");
+            if(target_corr.size() != tenors.size()) throw std::runtime_error("calibrateCorr needs one correlation row per tenor");
+            for(const auto& row : target_corr){
+                if(row.size() != tenors.size()) throw std::runtime_error("calibrateCorr needs a square correlation matrix");
+            }
+            LevenbergMarquardt lm([&](const std::vector<double>& x, std::vector<double>& r, std::vector<std::vector<double>>& J){
+                r.clear();
+                J.clear();
+                for(size_t i = 0; i < tenors.size(); ++i){
+                    for(size_t j = i + 1; j < tenors.size(); ++j){
+                        double gap = std::abs(tenors[i] - tenors[j]), first = std::min(tenors[i], tenors[j]);
+                        double scale = 1 + x[2]*first, e = exp(-x[1]*gap/scale);
+                        r.push_back(x[0] + (1 - x[0])*e - target_corr[i][j]);
+                        J.push_back({1 - e, -(1 - x[0])*e*gap/scale, (1 - x[0])*e*x[1]*gap*first/(scale*scale)});
+                    }
+                }
+            }, {0.0, 0.0, 0.0}, {1.0, 100.0, 100.0});
+            std::vector<std::vector<double>> starts;
+            for(double rho_inf : {0.2, 0.6, 0.9}){
+                for(double lambda : {0.1, 1.0}) starts.push_back({rho_inf, lambda, 0.5});
+            }
+            CalibrationResult result = lm.minimize(starts, calibrationThreadNum(starts.size()));
+            setCorr(result.params[0], result.params[1], result.params[2]);
+            return result;
+        }
+
+        void setThreadNum(size_t thread_num){//0 uses every hardware thread
+            m_thread_num = thread_num;
+            m_pool.reset();
+        }
+
+        //phase timers (setup, shocks, kernel, controls, reducers, merge) and per thread counters for every run,
+        //with hardware_counters also cycles, instructions and cache misses through perf_event_open; off by
+        //default, when a run pays one branch per group of paths. validateVol prints the report of the last run.
+        void setProfiling(bool profiling, bool hardware_counters = false){
+            m_profiling = profiling;
+            m_hardware_counters = profiling && hardware_counters;
+        }
+
+        const RunProfile& getProfile() const{//the last run, empty unless profiling was on
+            return m_profile;
+        }
+
+        void setSeed(unsigned int seed){//makes runs reproducible for any thread number
+            m_seed = seed;
+            m_seeded = true;
+        }
+
+        void addReducer(PathReducer<T>& reducer){//reducer must outlive the simulation runs
+            m_reducers.push_back(&reducer);
+        }
+
+        void clearReducers(){
+            m_reducers.clear();
+        }
+
+        const std::vector<std::vector<T>>& LiborSimulation(){//keeps every terminal curve, see LiborSimulationStream
+            m_output.assign(m_simulation_nums, std::vector<T>());
+            runPaths([this](size_t, const PathView<T>& view){
+                std::vector<T>& F = m_output[view.path];//each path owns its output slot
+                F.resize(view.num_rates);
+                for(size_t j = 0; j < view.num_rates; ++j) F[j] = view.forward(j);
+            });
+            return m_output;
+        }
+
+        //writes every path to a path store (see PathStoreHeader) through a shared mapping as paths are simulated;
+        //all_steps keeps the rates after every step, otherwise only the terminal rates. Read with PathStoreReader.
+        void LiborSimulationToFile(const std::string& file_name, bool all_steps = false){
+            if(!m_prepared) prepare();
+            const size_t n = m_num_rates, paths = m_simulation_nums, steps = all_steps ? m_num_time_steps : 1;
+            const size_t page = 4096;
+            size_t data_offset = (sizeof(PathStoreHeader) + (steps + n)*sizeof(double) + page - 1)/page*page;
+            MappedFile file(file_name, data_offset + steps*n*paths*sizeof(T));
+
+            double* meta = reinterpret_cast<double*>(file.data() + sizeof(PathStoreHeader));
+            if(all_steps) std::copy(m_step_times.begin(), m_step_times.end(), meta);
+            else meta[0] = m_step_times.back();
+            std::copy(m_init_rates.begin(), m_init_rates.end(), meta + steps);
+
+            T* columns = reinterpret_cast<T*>(file.data() + data_offset);
+            runPaths([&](size_t, const PathView<T>& view){//each path owns its slot in every column
+                for(size_t i = 0; i < steps; ++i){
+                    for(size_t j = 0; j < n; ++j){
+                        columns[(i*n + j)*paths + view.path] = all_steps ? view.forward(i, j) : view.forward(j);
+                    }
+                }
+            }, [](size_t, size_t){}, all_steps, 0, m_simulation_nums);
+
+            PathStoreHeader header;//written last, the key is known once the run has drawn it
+            std::memset(&header, 0, sizeof(header));
+            std::memcpy(header.magic, "LMMPATHS", 8);
+            header.version = PathStoreHeader::VERSION;
+            header.value_bytes = sizeof(T);
+            header.path_num = paths;
+            header.rate_num = n;
+            header.step_num = steps;
+            header.data_offset = data_offset;
+            header.seed = m_run_key;
+            header.seeded = m_seeded;
+            header.antithetic = m_antithetic;
+            header.shock_source = static_cast<uint32_t>(m_shock_source);
+            header.predictor_corrector = m_predictor_corrector;
+            header.factor_num = m_factor_num;
+            header.time_step_num = m_num_time_steps;
+            header.projection_years = m_projection_years;
+            header.maturity = m_maturity;
+            header.rate_freq = m_rate_freq;
+            std::copy(m_vol_params.begin(), m_vol_params.end(), header.vol_params);
+            header.vol_surface = static_cast<bool>(m_vol_surface);
+            std::copy(m_corr_params.begin(), m_corr_params.end(), header.corr_params);
+            std::memcpy(file.data(), &header, sizeof(header));
+            file.sync();
+        }
+
+        void LiborSimulationStream(){//feeds every path to the registered reducers without storing it
+            m_paths_done = 0;
+            streamPaths(0, m_simulation_nums);
+        }
+
+        //appends path_num paths to the last run and merges them into the registered reducers; with a path number
+        //that is a multiple of 256 before, the result is the one a single run of the total would have given
+        void extend(size_t path_num){
+            if(m_paths_done == 0) throw std::runtime_error("extend needs a previous LiborSimulationStream run");
+            if(m_antithetic && (m_paths_done % 2 || path_num % 2)) throw std::runtime_error("antithetic runs extend in pairs");
+            m_simulation_nums = m_paths_done + path_num;
+            streamPaths(m_paths_done, m_simulation_nums);
+        }
+
+        //simulates batches of batch_paths into the registered reducers until the standard error of every target is
+        //within its tolerance or max_paths are done. Batches are rounded up to whole chunks and appended with
+        //extend, so the reducers end up with the result of one LiborSimulationStream of the reported path number;
+        //like extend, this replaces the path number of the simulation with the reported one.
+        StoppingReport LiborSimulationToTarget(const std::vector<StoppingTarget>& targets, size_t batch_paths, size_t max_paths){
+            if(targets.empty()) throw std::runtime_error("no stopping targets");
+            batch_paths = std::max<size_t>((batch_paths + m_chunk_paths - 1)/m_chunk_paths, 1)*m_chunk_paths;
+            if(m_antithetic) max_paths -= max_paths % 2;
+            if(max_paths == 0) throw std::runtime_error("the path limit must allow one path");
+            StoppingReport report{0, 0, false, std::vector<double>(targets.size()), std::vector<double>(targets.size()),
+                                  std::vector<double>(targets.size())};
+            while(!report.converged && report.path_num < max_paths){
+                size_t batch = std::min(batch_paths, max_paths - report.path_num);
+                if(report.batch_num++ == 0){
+                    m_simulation_nums = batch;
+                    LiborSimulationStream();
+                }
+                else extend(batch);
+                report.path_num = m_paths_done;
+                report.converged = true;
+                for(size_t k = 0; k < targets.size(); ++k){
+                    report.values[k] = targets[k].value();
+                    report.std_errors[k] = targets[k].std_error();
+                    report.tolerances[k] = std::max(targets[k].abs_tol, targets[k].rel_tol*std::abs(report.values[k]));
+                    report.converged = report.converged && report.std_errors[k] <= report.tolerances[k];
+                }
+            }
+            return report;
+        }
+
+        //runs the paths of this simulation under every scenario with common random numbers: the shocks of a path
+        //are drawn once, from the seed, shock source and antithetic setting of this simulation, and each scenario
+        //evolves them with its own vols, correlations and initial curve. Scenario s feeds its own registered
+        //reducers and the scenario reducers see the path under all scenarios at once. Lockstep runs one group of
+        //lanes under every scenario in turn; Blocked keeps the shocks of a whole chunk and sweeps it scenario by
+        //scenario, so each scenario's step tables stay in cache. Both orders give the same results, and a
+        //scenario equal to this simulation gives the results of LiborSimulationStream with the same seed.
+        void LiborSimulationScenarios(const std::vector<LiborRateSimulation<T>*>& scenarios,
+                                      const std::vector<ScenarioReducer<T>*>& scenario_reducers = {},
+                                      ScenarioOrder order = ScenarioOrder::Lockstep){
+            if(scenarios.empty()) throw std::runtime_error("no scenarios to run");
+            if(m_antithetic && m_simulation_nums % 2) throw std::runtime_error("antithetic runs need an even path number");
+            if(!m_prepared) prepare();
+            size_t scratch_num = 0;
+            bool history = false;
+            for(auto scenario : scenarios){
+                if(!scenario->m_prepared) scenario->prepare();
+                if(scenario->m_num_rates != m_num_rates || scenario->m_step_times != m_step_times
+                   || scenario->m_shock_num != m_shock_num){
+                    throw std::runtime_error("scenarios must share the rates, time steps and factor number of the simulation");
+                }
+                scratch_num = std::max(scratch_num, scenario->scratchNum());
+                for(auto reducer : scenario->m_reducers) history = history || reducer->needsHistory();
+            }
+            for(auto reducer : scenario_reducers) history = history || reducer->needsHistory();
+
+            struct Reducers{//one worker's clones: every scenario's registered reducers, then the scenario reducers
+                std::vector<std::vector<std::unique_ptr<PathReducer<T>>>> paths;
+                std::vector<std::unique_ptr<ScenarioReducer<T>>> scenarios;
+            };
+            auto fresh = [&](){
+                Reducers local;
+                for(auto scenario : scenarios){
+                    local.paths.emplace_back();
+                    for(auto reducer : scenario->m_reducers) local.paths.back().push_back(reducer->clone());
+                }
+                for(auto reducer : scenario_reducers) local.scenarios.push_back(reducer->clone());
+                return local;
+            };
+            struct Buffers{//one scenario's state of every group of lanes in a block
+                AlignedVector<T> rates, discounts, controls, partial, history, discount_history;
+            };
+
+            size_t thread_num = threadNum();
+            SimdLevel level = getSimdLevel();
+            const size_t lanes = laneNum(level), n = m_num_rates;
+            const size_t group_num = order == ScenarioOrder::Blocked ? m_chunk_paths/lanes : 1;//groups of lanes per block
+            const size_t step_shocks = m_num_time_steps*m_shock_num, steps = m_num_time_steps;
+            static std::random_device rd;
+            uint64_t key = m_seeded ? m_seed : (uint64_t(rd()) << 32) | rd();
+            std::vector<Workspace> workspace = makeWorkspaces(thread_num, key, lanes, 0, false);
+            std::vector<std::vector<Buffers>> buffers(thread_num, std::vector<Buffers>(scenarios.size()));
+            for(size_t w = 0; w < thread_num; ++w){
+                workspace[w].shocks.resize(group_num*step_shocks*lanes);
+                for(size_t s = 0; s < scenarios.size(); ++s){
+                    Buffers& b = buffers[w][s];
+                    b.rates.resize(group_num*n*lanes);
+                    b.discounts.resize(group_num*n*lanes);
+                    b.partial.resize(group_num*scratch_num*lanes);
+                    if(scenarios[s]->m_control_variates) b.controls.resize(group_num*n*lanes);
+                    if(history){
+                        b.history.resize(group_num*steps*n*lanes);
+                        b.discount_history.resize(group_num*steps*n*lanes);
+                    }
+                }
+            }
+            std::vector<Reducers> worker_reducers(thread_num);
+            for(auto& local : worker_reducers) local = fresh();
+            OrderedMerge<Reducers> ordered;
+
+            ThreadPool& pool = m_pool.get(thread_num);
+            pool.parallelFor(0, m_simulation_nums, m_chunk_paths, [&](size_t worker_id, size_t chunk_begin, size_t chunk_end){
+                Workspace& ws = workspace[worker_id];
+                std::vector<Buffers>& buf = buffers[worker_id];
+                Reducers& local = worker_reducers[worker_id];
+                std::vector<PathView<T>> views(scenarios.size(), PathView<T>{0, nullptr, n, lanes});
+                if(ws.sobol) ws.sobol->skipTo(m_antithetic ? chunk_begin/2 : chunk_begin);
+                for(size_t block = chunk_begin; block < chunk_end; block += group_num*lanes){
+                    size_t groups = std::min(group_num, (chunk_end - block + lanes - 1)/lanes);
+                    for(size_t g = 0; g < groups; ++g){
+                        T* shocks = &ws.shocks[g*step_shocks*lanes];
+                        fillShocks(ws, shocks, g ? shocks - step_shocks*lanes : shocks, block + g*lanes, chunk_end, lanes);
+                    }
+                    for(size_t s = 0; s < scenarios.size(); ++s){
+                        const LiborRateSimulation<T>& scenario = *scenarios[s];
+                        Buffers& b = buf[s];
+                        for(size_t g = 0; g < groups; ++g){
+                            const T* shocks = &ws.shocks[g*step_shocks*lanes];
+                            scenario.evolve(level, shocks, &b.rates[g*n*lanes], &b.discounts[g*n*lanes],
+                                            &b.partial[g*scratch_num*lanes], history ? &b.history[g*steps*n*lanes] : nullptr,
+                                            history ? &b.discount_history[g*steps*n*lanes] : nullptr);
+                            if(scenario.m_control_variates) scenario.driftlessForwards(shocks, &b.controls[g*n*lanes], lanes);
+                        }
+                    }
+                    for(size_t g = 0; g < groups; ++g){
+                        for(size_t l = 0, i = block + g*lanes; l < lanes && i + l < chunk_end; ++l){
+                            for(size_t s = 0; s < scenarios.size(); ++s){
+                                Buffers& b = buf[s];
+                                views[s] = laneView(i + l, l, lanes, &ws.shocks[g*step_shocks*lanes], &b.rates[g*n*lanes],
+                                                    &b.discounts[g*n*lanes],
+                                                    scenarios[s]->m_control_variates ? &b.controls[g*n*lanes] : nullptr,
+                                                    history ? &b.history[g*steps*n*lanes] : nullptr,
+                                                    history ? &b.discount_history[g*steps*n*lanes] : nullptr);
+                                for(auto& reducer : local.paths[s]) reducer->observePath(views[s]);
+                            }
+                            for(auto& reducer : local.scenarios) reducer->observeScenarios(views);
+                        }
+                    }
+                }
+                Reducers done = fresh();
+                std::swap(done, local);
+                ordered.add(chunk_begin/m_chunk_paths, std::move(done), [&](size_t, Reducers& chunk){
+                    for(size_t s = 0; s < scenarios.size(); ++s){
+                        for(size_t r = 0; r < scenarios[s]->m_reducers.size(); ++r){
+                            scenarios[s]->m_reducers[r]->merge(*chunk.paths[s][r]);
+                        }
+                    }
+                    for(size_t r = 0; r < scenario_reducers.size(); ++r) scenario_reducers[r]->merge(*chunk.scenarios[r]);
+                });
+            });
+        }
+
+        //LiborSimulationStream and extend save a checkpoint to file_name every interval_paths merged paths;
+        //an empty file_name turns checkpoints off
+        void setCheckpoint(const std::string& file_name, size_t interval_paths){
+            m_checkpoint_file = file_name;
+            m_checkpoint_interval = std::max<size_t>(interval_paths, 1);
+        }
+
+        //paths done, the Philox key and the state of every registered reducer, in registration order; written to
+        //a temporary file first so a job killed while saving keeps the previous checkpoint
+        void saveCheckpoint(const std::string& file_name){
+            if(!m_prepared) prepare();
+            std::string temp_name = file_name + ".tmp";
+            {
+                std::ofstream out(temp_name, std::ios::binary | std::ios::trunc);
+                out.write("LMMCKPT1", 8);
+                for(uint64_t field : checkpointFields()) writeValue(out, field);
+                writeValue(out, static_cast<uint64_t>(m_paths_done));
+                writeValue(out, static_cast<uint64_t>(m_simulation_nums));
+                writeValue(out, m_run_key);
+                for(auto reducer : m_reducers) reducer->save(out);
+                if(!out) throw std::runtime_error("cannot write checkpoint " + temp_name);
+            }
+            if(std::rename(temp_name.c_str(), file_name.c_str()) != 0) throw std::runtime_error("cannot replace " + file_name);
+        }
+
+        //restores a checkpoint into the registered reducers, which must be set up as when it was saved, and
+        //simulates the paths left to the path number of the saved run; returns the number of paths it had done
+        size_t resume(const std::string& file_name){
+            if(!m_prepared) prepare();
+            std::ifstream in(file_name, std::ios::binary);
+            char magic[8];
+            if(!in.read(magic, 8) || std::memcmp(magic, "LMMCKPT1", 8) != 0) throw std::runtime_error(file_name + " is not a checkpoint");
+            for(uint64_t field : checkpointFields()){
+                uint64_t saved;
+                readValue(in, saved);
+                if(saved != field) throw std::runtime_error("checkpoint was saved with other simulation settings");
+            }
+            uint64_t paths_done, simulation_nums;
+            readValue(in, paths_done);
+            readValue(in, simulation_nums);
+            readValue(in, m_run_key);
+            for(auto reducer : m_reducers) reducer->load(in);
+            m_paths_done = paths_done;
+            m_simulation_nums = simulation_nums;//the target of the run, extend may have raised it
+            if(m_paths_done < m_simulation_nums) streamPaths(m_paths_done, m_simulation_nums);
+            return paths_done;
+        }
+
+        //paths of shard shard out of shard_num, in whole chunks so that every shard merges like part of one run
+        std::pair<size_t, size_t> shardRange(size_t shard, size_t shard_num) const{
+            size_t chunks = (m_simulation_nums + m_chunk_paths - 1)/m_chunk_paths;
+            size_t begin = std::min(chunks*shard/shard_num*m_chunk_paths, m_simulation_nums);
+            size_t end = std::min(chunks*(shard+1)/shard_num*m_chunk_paths, m_simulation_nums);
+            return {begin, end};
+        }
+
+        //simulates the paths of shardRange(shard, shard_num) and writes the registered reducers of every chunk to
+        //file_name, in chunk order; the registered reducers are left untouched. The shocks of a path depend only
+        //on the seed, which must be set, so separate processes can each run one shard.
+        //Chunks are kept apart so the merge repeats the single process sums exactly, which costs disk: the file
+        //holds one saved reducer set per 256 paths. A CurveStatsReducer saves 40 bytes per step and rate, so
+        //120 steps of 119 rates take about 2 GB per million paths across all shards.
+        void simulateShard(size_t shard, size_t shard_num, const std::string& file_name){
+            if(!m_seeded) throw std::runtime_error("sharded runs need a seed");
+            if(shard >= shard_num) throw std::runtime_error("no shard " + std::to_string(shard));
+            if(!m_prepared) prepare();
+            std::pair<size_t, size_t> range = shardRange(shard, shard_num);
+            typedef std::vector<std::unique_ptr<PathReducer<T>>> ReducerSet;
+            auto fresh = [this](){
+                ReducerSet local;
+                for(auto reducer : m_reducers) local.push_back(reducer->clone());
+                return local;
+            };
+            std::ofstream out(file_name, std::ios::binary | std::ios::trunc);
+            out.write("LMMSHRD1", 8);
+            for(uint64_t field : checkpointFields()) writeValue(out, field);
+            for(uint64_t field : {uint64_t(range.first), uint64_t(range.second), uint64_t(m_simulation_nums), uint64_t(m_seed)}){
+                writeValue(out, field);
+            }
+            std::vector<ReducerSet> worker_reducers(threadNum());
+            for(auto& local : worker_reducers) local = fresh();
+            OrderedMerge<ReducerSet> ordered;
+            bool history = false;
+            for(auto reducer : m_reducers) history = history || reducer->needsHistory();
+            size_t paths_done = m_paths_done;
+            m_run_key = m_seed;//the key of a run from path 0 with this seed
+            runPaths([&](size_t worker_id, const PathView<T>& view){
+                for(auto& reducer : worker_reducers[worker_id]) reducer->observePath(view);
+            }, [&](size_t worker_id, size_t chunk){
+                ReducerSet done = fresh();
+                done.swap(worker_reducers[worker_id]);
+                ordered.add(chunk, std::move(done), [&](size_t, ReducerSet& reducers){
+                    for(auto& reducer : reducers) reducer->save(out);
+                });
+            }, history, range.first, range.second);
+            m_paths_done = paths_done;
+            if(!out) throw std::runtime_error("cannot write shard " + file_name);
+        }
+
+        //merges shard files of simulateShard into the registered reducers, chunk by chunk in path order, which
+        //gives exactly the result of LiborSimulationStream with the same seed; file_names list the shards in order
+        //and must cover every path of the run. All headers are checked before any reducer changes.
+        void mergeShards(const std::vector<std::string>& file_names){
+            if(!m_seeded) throw std::runtime_error("sharded runs need a seed");
+            if(!m_prepared) prepare();
+            std::vector<std::ifstream> shards;
+            std::vector<uint64_t> path_ends;
+            uint64_t paths_done = 0, simulation_nums = 0;
+            for(const std::string& file_name : file_names){
+                shards.emplace_back(file_name, std::ios::binary);
+                std::ifstream& in = shards.back();
+                char magic[8];
+                if(!in.read(magic, 8) || std::memcmp(magic, "LMMSHRD1", 8) != 0) throw std::runtime_error(file_name + " is not a shard");
+                for(uint64_t field : checkpointFields()){
+                    uint64_t saved;
+                    readValue(in, saved);
+                    if(saved != field) throw std::runtime_error("shard was simulated with other simulation settings");
+                }
+                uint64_t path_begin, path_end, shard_nums, key;
+                readValue(in, path_begin);
+                readValue(in, path_end);
+                readValue(in, shard_nums);
+                readValue(in, key);
+                if(path_begin != paths_done || key != m_seed || (!path_ends.empty() && shard_nums != simulation_nums)){
+                    throw std::runtime_error(file_name + " does not continue the merged shards");
+                }
+                paths_done = path_end;
+                simulation_nums = shard_nums;
+                path_ends.push_back(path_end);
+            }
+            if(path_ends.empty() || paths_done != simulation_nums){
+                throw std::runtime_error("shards cover " + std::to_string(paths_done) + " of " + std::to_string(simulation_nums) + " paths");
+            }
+            for(size_t s = 0, path_begin = 0; s < shards.size(); path_begin = path_ends[s++]){
+                for(size_t chunk_begin = path_begin; chunk_begin < path_ends[s]; chunk_begin += m_chunk_paths){
+                    for(auto reducer : m_reducers){
+                        std::unique_ptr<PathReducer<T>> chunk = reducer->clone();
+                        chunk->load(shards[s]);
+                        reducer->merge(*chunk);
+                    }
+                }
+                if(!shards[s]) throw std::runtime_error(file_names[s] + " is truncated");
+            }
+            m_simulation_nums = simulation_nums;
+            m_paths_done = paths_done;
+            m_run_key = m_seed;//extend carries on from the merged paths
+        }
+
+        //runs the paths on process_num local worker processes, one shard each, written to file_prefix.<shard>,
+        //then merges the shards here and removes their files; the result is that of LiborSimulationStream.
+        //Each worker runs its share threadNum()/process_num of the threads, at least one, so the processes do not
+        //oversubscribe the cores. A worker that fails sends its error message back through a pipe, which is raised here.
+        void LiborSimulationSharded(size_t process_num, const std::string& file_prefix){
+            if(!m_seeded) throw std::runtime_error("sharded runs need a seed");
+            if(!m_prepared) prepare();
+            std::vector<std::string> file_names;
+            std::vector<pid_t> workers;
+            std::vector<int> messages;//read ends of the workers' error pipes
+            std::string error;
+            for(size_t shard = 0; shard < process_num; ++shard){
+                file_names.push_back(file_prefix + "." + std::to_string(shard));
+                int fds[2];
+                if(pipe(fds) != 0){
+                    error = "cannot open a pipe to shard " + std::to_string(shard);
+                    break;
+                }
+                pid_t pid = fork();//only this thread is copied, the child drops the kept pool and builds its own
+                if(pid == 0){
+                    close(fds[0]);
+                    m_pool.abandon();
+                    m_thread_num = std::max<size_t>(threadNum()/process_num, 1);//results do not depend on it
+                    std::string message;
+                    try{
+                        simulateShard(shard, process_num, file_names.back());
+                    }
+                    catch(const std::exception& e){
+                        message = e.what();
+                    }
+                    catch(...){
+                        message = "unknown error";
+                    }
+                    if(message.empty()) _exit(0);
+                    ssize_t written = write(fds[1], message.data(), message.size());
+                    _exit(written < 0 ? 2 : 1);
+                }
+                close(fds[1]);
+                if(pid < 0){
+                    close(fds[0]);
+                    error = "cannot start shard " + std::to_string(shard);
+                    break;
+                }
+                workers.push_back(pid);
+                messages.push_back(fds[0]);
+            }
+            for(size_t shard = 0; shard < workers.size(); ++shard){
+                std::string message;
+                char buffer[256];
+                for(ssize_t got; (got = read(messages[shard], buffer, sizeof(buffer))) > 0;) message.append(buffer, got);
+                close(messages[shard]);
+                int status;
+                bool ok = waitpid(workers[shard], &status, 0) == workers[shard] && WIFEXITED(status) && WEXITSTATUS(status) == 0;
+                if(!ok && error.empty()) error = "shard " + std::to_string(shard) + " failed: " + (message.empty() ? "worker died" : message);
+            }
+            if(error.empty()){
+                try{
+                    mergeShards(file_names);
+                }
+                catch(const std::exception& e){
+                    error = e.what();
+                }
+            }
+            for(const std::string& file_name : file_names) std::remove(file_name.c_str());
+            if(!error.empty()) throw std::runtime_error(error);
+        }
+
+        size_t getPathsDone() const{//paths merged into the reducers by the current run
+            return m_paths_done;
+        }
+
+        std::vector<T> LiborSimulationOnePath(){
+            static std::random_device rd;
+            NormalBlockGenerator<T> rand_gen((uint64_t(rd()) << 32) | rd());
+            std::vector<T> shocks(m_num_time_steps*getShockNum());
+            rand_gen.fill(0, shocks.data(), shocks.size());
+            std::vector<T> F;
+            LiborSimulationOnePath(shocks.data(), F);
+            return F;
+        }
+
+        //shocks holds num_time_steps*getShockNum() standard normals, step major; F is overwritten with the terminal rates
+        void LiborSimulationOnePath(const T* shocks, std::vector<T>& F){
+            if(!m_prepared) prepare();
+            static thread_local AlignedVector<T> partial, D;//running drift sums per factor, bonds
+            partial.resize(scratchNum());
+            D.resize(m_num_rates);
+            F.resize(m_num_rates);
+            evolveLanes<1>(shocks, F.data(), D.data(), partial.data(), nullptr, nullptr);
+        }
+
+        //adjoint mode: payoff(F, F_bar) returns the payoff of the terminal rates F and writes its gradient to F_bar;
+        //a reverse sweep over the checkpointed steps then gives delta (to every initial forward) and vega (to the
+        //a, b, c, d of setVol). Returns the payoff.
+        template <class Payoff>
+        double LiborSimulationOnePath(const T* shocks, Payoff payoff, std::vector<double>& delta, std::vector<double>& vega){
+            if(m_vol_surface) throw std::runtime_error("adjoint vegas need the parametric vol of setVol");
+            if(m_predictor_corrector) throw std::runtime_error("the adjoint sweep follows the log-Euler step only");
+            if(!m_prepared) prepare();
+            const size_t n = m_num_rates, m = m_corr_factor_num, shock_num = m_shock_num;
+            const double tau = m_rate_freq, drift_scale = sqrt(m_rate_freq);
+            static thread_local AlignedVector<T> partial, history;//forward pass, every step is a checkpoint
+            static thread_local std::vector<T> F, D;
+            static thread_local std::vector<double> S, S_bar, sigma_bar;
+            partial.resize(scratchNum());
+            history.resize(m_num_time_steps*n);
+            F.resize(n);
+            D.resize(n);
+            evolveLanes<1>(shocks, F.data(), D.data(), partial.data(), history.data(), nullptr);
+            delta.assign(n, 0.0);
+            double value = payoff(F, delta);
+
+            S.resize((n+1)*m);
+            S_bar.resize(m);
+            sigma_bar.assign(n, 0.0);
+            for(unsigned long i = m_num_time_steps; i-- > 0;){//reverse sweep, delta holds the adjoint of the rates
+                const T* F_old = i ? &history[(i-1)*n] : m_init_rates.data();
+                const T* F_new = &history[i*n];
+                const T* A = &m_drift_load[i*m_drift_load_stride];
+                const double dt = m_step_dt[i], sqrt_dt = sqrt(dt);
+                for(size_t f = 0; f < m; ++f) S[f] = 0.0;
+                for(size_t j = 0; j < n; ++j){//running drift sums seen by each rate, S[j*m+f] covers rates k<j
+                    double x_new = F_new[j]/(1 + tau*F_new[j]);
+                    for(size_t f = 0; f < m; ++f) S[(j+1)*m+f] = S[j*m+f] + A[j*m+f]*x_new;
+                }
+                std::fill(S_bar.begin(), S_bar.end(), 0.0);
+                for(size_t j = n; j-- > 0;){
+                    const T* Aj = &A[j*m];
+                    const double* Sj = &S[j*m];
+                    const double* Cj = &m_corr_factor[j*m];
+                    double F0 = F_old[j], F1 = F_new[j];
+                    double x_old = F0/(1 + tau*F0), x_new = F1/(1 + tau*F1);
+                    double x_new_bar = 0.0;
+                    for(size_t f = 0; f < m; ++f) x_new_bar += Aj[f]*S_bar[f];
+                    double F1_bar = delta[j] + x_new_bar/((1 + tau*F1)*(1 + tau*F1));
+                    double y_bar = F1_bar*F1;//F1 = F0*exp(y)
+                    double drift_bar = y_bar*dt;
+                    double load_bar = 0.0, load_sq = 0.0;
+                    for(size_t f = 0; f < m; ++f){//y = dt*sum_f A_jf*(S_f + A_jf*x_old) - ito + vol*sqrt(dt)*z
+                        load_bar += Cj[f]*(x_new*S_bar[f] + drift_bar*(Sj[f] + 2*Aj[f]*x_old));
+                        S_bar[f] += drift_bar*Aj[f];
+                        load_sq += Aj[f]*Aj[f];
+                    }
+                    sigma_bar[j] += drift_scale*load_bar + y_bar*(rateShock(&shocks[i*shock_num], j, 1, 0)*sqrt_dt - m_sigma[j]*dt);
+                    delta[j] = F1_bar*F1/F0 + drift_bar*load_sq/((1 + tau*F0)*(1 + tau*F0));
+                }
+            }
+
+            const double a = m_vol_params[0], b = m_vol_params[1], d = m_vol_params[3];
+            vega.assign(4, 0.0);
+            for(size_t j = 0; j < n; ++j){//sigma_j = (a*t+d)*exp(-b*t)+c at t = (j+1)*tau
+                double t = (j+1)*tau, e = exp(-b*t);
+                vega[0] += sigma_bar[j]*t*e;
+                vega[1] -= sigma_bar[j]*t*(a*t + d)*e;
+                vega[2] += sigma_bar[j];
+                vega[3] += sigma_bar[j]*e;
+            }
+            return value;
+        }
+
+        //pathwise price and Greeks averaged over simulation_nums paths drawn exactly as in LiborSimulationStream,
+        //see the adjoint LiborSimulationOnePath for payoff, delta and vega. The adjoint runs its own forward pass,
+        //so the shocks are drawn here one path at a time and no path goes through the SIMD kernel.
+        template <class Payoff>
+        double LiborSimulationGreeks(Payoff payoff, std::vector<double>& delta, std::vector<double>& vega){
+            if(m_vol_surface) throw std::runtime_error("adjoint vegas need the parametric vol of setVol");
+            if(m_predictor_corrector) throw std::runtime_error("the adjoint sweep follows the log-Euler step only");
+            if(m_antithetic && m_simulation_nums % 2) throw std::runtime_error("antithetic runs need an even path number");
+            if(!m_prepared) prepare();
+            const size_t n = m_num_rates, thread_num = threadNum();
+            static std::random_device rd;
+            uint64_t key = m_seeded ? m_seed : (uint64_t(rd()) << 32) | rd();
+            std::vector<Workspace> workspace = makeWorkspaces(thread_num, key, 1, 0, false);
+            //per chunk sums of price, deltas and vegas, added up in chunk order for thread independent results
+            std::vector<std::vector<double>> chunk_sums((m_simulation_nums + m_chunk_paths - 1)/m_chunk_paths);
+            ThreadPool& pool = m_pool.get(thread_num);
+            pool.parallelFor(0, m_simulation_nums, m_chunk_paths, [&](size_t worker_id, size_t chunk_begin, size_t chunk_end){
+                Workspace& ws = workspace[worker_id];
+                static thread_local std::vector<double> path_delta, path_vega;
+                std::vector<double>& sums = chunk_sums[chunk_begin/m_chunk_paths];
+                sums.assign(1 + n + 4, 0.0);
+                if(ws.sobol) ws.sobol->skipTo(m_antithetic ? chunk_begin/2 : chunk_begin);
+                for(size_t i = chunk_begin; i < chunk_end; ++i){//an odd antithetic path mirrors the shocks still in the buffer
+                    fillShocks(ws, ws.shocks.data(), ws.shocks.data(), i, chunk_end, 1);
+                    sums[0] += LiborSimulationOnePath(ws.shocks.data(), payoff, path_delta, path_vega);
+                    for(size_t j = 0; j < n; ++j) sums[1+j] += path_delta[j];
+                    for(size_t p = 0; p < 4; ++p) sums[1+n+p] += path_vega[p];
+                }
+            });
+            std::vector<double> total(1 + n + 4, 0.0);
+            for(const auto& sums : chunk_sums){
+                for(size_t k = 0; k < sums.size(); ++k) total[k] += sums[k];
+            }
+            for(double& x : total) x /= m_simulation_nums;
+            delta.assign(total.begin() + 1, total.begin() + 1 + n);
+            vega.assign(total.begin() + 1 + n, total.end());
+            return total[0];
+        }
+
+        void setShockSource(ShockSource source){//Sobol paths are fixed by the seed, independent of the thread number
+            m_shock_source = source;
+        }
+
+        //pairs every path with its mirror image; runs then need an even path number, a path without its mirror
+        //would not be an independent sample
+        void setAntithetic(bool antithetic){
+            m_antithetic = antithetic;
+        }
+
+        void setControlVariates(bool control_variates){//exposes drift free forwards as PathView::control
+            m_control_variates = control_variates;
+        }
+
+        const std::vector<T>& getInitRates() const{//expectations of the drift free forward controls
+            return m_init_rates;
+        }
+
+        void setSimdLevel(SimdLevel level){//Auto picks the widest instruction set the cpu supports
+            m_simd_level = level;
+        }
+
+        SimdLevel getSimdLevel() const{//level the simulation runs with
+            SimdLevel supported = supportedSimdLevel();
+            if(m_simd_level == SimdLevel::Auto) return supported;
+            return static_cast<int>(m_simd_level) < static_cast<int>(supported) ? m_simd_level : supported;
+        }
+
+        void setDriftTolerance(double tol){//share of the correlation trace the drift factors may leave out, 0 keeps all
+            m_drift_tol = tol;
+            m_corr_factor_num = 0;
+            m_prepared = false;
+        }
+
+        //k > 0 drives the curve from the k leading principal components of the correlation, k normals per step,
+        //with the loadings rescaled to unit variance and the drift taken from the same k factors;
+        //0 (the default) draws one independent normal per rate and keeps the correlation in the drift only
+        void setFactorNum(size_t k){
+            m_factor_num = k;
+            m_corr_factor_num = 0;
+            m_prepared = false;
+        }
+
+        //steps end at times, strictly increasing; replaces the uniform projection_years/num_time_steps grid
+        void setTimeGrid(const std::vector<double>& times){
+            for(size_t i = 0; i < times.size(); ++i){
+                if(times[i] <= (i ? times[i-1] : 0.0)) throw std::runtime_error("step times must be positive and increasing");
+            }
+            if(times.empty()) throw std::runtime_error("the time grid needs at least one step");
+            m_step_times = times;
+            m_num_time_steps = times.size();
+            m_projection_years = times.back();
+            m_dt = m_projection_years/m_num_time_steps;
+            m_prepared = false;
+        }
+
+        const std::vector<double>& getTimeGrid() const{
+            return m_step_times;
+        }
+
+        //grid to the projection horizon that lands on every fixing (j+1)*rate_freq, with steps of at most max_step
+        std::vector<double> fixingTimeGrid(double max_step) const{
+            std::vector<double> nodes;
+            for(int j = 0; j < m_num_rates && (j+1)*m_rate_freq < m_projection_years - 1e-9; ++j) nodes.push_back((j+1)*m_rate_freq);
+            nodes.push_back(m_projection_years);
+            std::vector<double> times;
+            double start = 0.0;
+            for(double node : nodes){
+                size_t parts = std::max<size_t>(1, static_cast<size_t>(ceil((node - start)/max_step - 1e-9)));
+                for(size_t k = 1; k < parts; ++k) times.push_back(start + (node - start)*k/parts);
+                times.push_back(node);
+                start = node;
+            }
+            return times;
+        }
+
+        //predictor-corrector drift: the average of the start of step drift and the drift of the Euler predicted rates
+        void setPredictorCorrector(bool predictor_corrector){
+            m_predictor_corrector = predictor_corrector;
+        }
+
+        //discretisation bias for each step number, log-Euler and predictor-corrector, from the martingale
+        //E[P(T,T_{j+1})/P(T,T_0)] = P(0,T_{j+1})/P(0,T_0) on eight forwards across the curve; uses the current
+        //path number, seed and settings and leaves them, the registered reducers and the last run as they were,
+        //also when a run throws, so extend still carries on from the run before the benchmark
+        std::vector<StepBiasResult> stepBiasBenchmark(const std::vector<unsigned long>& step_nums){
+            struct Restore{//puts the run back however the benchmark ends
+                LiborRateSimulation<T>& lmm;
+                std::vector<double> grid;
+                bool predictor_corrector;
+                std::vector<PathReducer<T>*> reducers;
+                size_t paths_done;
+                size_t simulation_nums;
+                uint64_t run_key;
+                ~Restore(){
+                    lmm.setTimeGrid(grid);
+                    lmm.setPredictorCorrector(predictor_corrector);
+                    lmm.m_reducers.swap(reducers);
+                    lmm.m_paths_done = paths_done;
+                    lmm.m_simulation_nums = simulation_nums;
+                    lmm.m_run_key = run_key;
+                }
+            } restore{*this, m_step_times, m_predictor_corrector, {}, m_paths_done, m_simulation_nums, m_run_key};
+            const std::vector<double>& grid = restore.grid;
+            restore.reducers.swap(m_reducers);
+            std::vector<size_t> rates;
+            for(size_t q = 1; q <= 8; ++q) rates.push_back(std::max<size_t>(q*m_num_rates/8, 1) - 1);
+            std::vector<StepBiasResult> results;
+            for(unsigned long step_num : step_nums){
+                std::vector<double> uniform;
+                for(unsigned long i = 0; i < step_num; ++i) uniform.push_back((i+1)*grid.back()/step_num);
+                setTimeGrid(uniform);
+                for(bool corrector : {false, true}){
+                    setPredictorCorrector(corrector);
+                    std::vector<std::unique_ptr<PayoffReducer<T>>> bonds;
+                    for(size_t j : rates){
+                        double exact = discountMean(j);
+                        bonds.emplace_back(new PayoffReducer<T>([j, exact](const PathView<T>& path){
+                            return path.discount(j)/exact - 1.0;
+                        }));
+                        addReducer(*bonds.back());
+                    }
+                    auto start = std::chrono::steady_clock::now();
+                    LiborSimulationStream();
+                    StepBiasResult result{step_num, corrector, 0.0, 0.0,
+                                          std::chrono::duration<double>(std::chrono::steady_clock::now() - start).count()};
+                    for(auto& bond : bonds){
+                        if(std::abs(bond->mean()) >= std::abs(result.max_bias)){
+                            result.max_bias = bond->mean();
+                            result.std_error = bond->stdError();
+                        }
+                    }
+                    clearReducers();
+                    std::cout<<"Steps: "<<step_num<<", Scheme: "<<(corrector ? "Predictor-Corrector" : "Log-Euler")
+                    <<", Max Relative Bias: "<<result.max_bias<<", Std Error: "<<result.std_error
+                    <<", Seconds: "<<result.seconds<<std::endl;
+                    results.push_back(result);
+                }
+            }
+            return results;
+        }
+
+        //error of the mixed precision mode on this setup: path_num paths in double and in float from the same seed
+        //(0 if none is set), compared path by path on up to 16384 terminal curves and in the terminal means,
+        //standard deviations and at the money caplet prices of a full run each, which is also timed
+        PrecisionReport precisionReport(int path_num) const{
+            LiborRateSimulation<double> reference(*this, path_num);
+            LiborRateSimulation<float> mixed(*this, path_num);
+            if(!m_seeded){
+                reference.setSeed(0);
+                mixed.setSeed(0);
+            }
+            std::vector<size_t> caplets;//forwards fixing on the grid
+            for(int j = 0; j < m_num_rates && (j+1)*m_rate_freq <= m_step_times.back() + 1e-9; ++j) caplets.push_back(j);
+            PrecisionReport report{size_t(path_num), 0.0, 0.0, 0.0, 0.0, 0.0, 0.0};
+
+            VarianceReducer<double> reference_stats(m_num_rates);
+            PricingReducer<double> reference_prices = reference.pricingReducer();
+            for(size_t j : caplets) reference_prices.addCap(m_init_rates[j], j, j+1);
+            reference.addReducer(reference_stats);
+            reference.addReducer(reference_prices);
+            auto start = std::chrono::steady_clock::now();
+            reference.LiborSimulationStream();
+            report.double_seconds = std::chrono::duration<double>(std::chrono::steady_clock::now() - start).count();
+
+            VarianceReducer<float> mixed_stats(m_num_rates);
+            PricingReducer<float> mixed_prices = mixed.pricingReducer();
+            for(size_t j : caplets) mixed_prices.addCap(m_init_rates[j], j, j+1);
+            mixed.addReducer(mixed_stats);
+            mixed.addReducer(mixed_prices);
+            start = std::chrono::steady_clock::now();
+            mixed.LiborSimulationStream();
+            report.float_seconds = std::chrono::duration<double>(std::chrono::steady_clock::now() - start).count();
+
+            for(int j = 0; j < m_num_rates; ++j){
+                double mean = reference_stats.mean(j), vol = sqrt(reference_stats.variance(j));
+                report.max_mean_error = std::max(report.max_mean_error, std::abs(mixed_stats.mean(j)/mean - 1));
+                report.max_vol_error = std::max(report.max_vol_error, std::abs(sqrt(mixed_stats.variance(j))/vol - 1));
+            }
+            for(size_t i = 0; i < caplets.size(); ++i){
+                double gap = std::abs(mixed_prices.price(i) - reference_prices.price(i));
+                report.max_price_error = std::max(report.max_price_error, gap/reference_prices.stdError(i));
+            }
+
+            int sample_num = std::min(path_num, 16384);
+            LiborRateSimulation<double> reference_sample(reference, sample_num);
+            LiborRateSimulation<float> mixed_sample(reference, sample_num);
+            const std::vector<std::vector<double>>& reference_paths = reference_sample.LiborSimulation();
+            const std::vector<std::vector<float>>& mixed_paths = mixed_sample.LiborSimulation();
+            for(int path = 0; path < sample_num; ++path){
+                for(int j = 0; j < m_num_rates; ++j){
+                    double gap = std::abs(mixed_paths[path][j]/reference_paths[path][j] - 1);
+                    report.max_path_error = std::max(report.max_path_error, gap);
+                }
+            }
+
+            std::cout<<"Paths: "<<report.path_num<<", Max Path Error: "<<report.max_path_error
+            <<", Max Mean Error: "<<report.max_mean_error<<", Max Vol Error: "<<report.max_vol_error
+            <<", Max Caplet Error (std errors): "<<report.max_price_error<<", Double Seconds: "<<report.double_seconds
+            <<", Float Seconds: "<<report.float_seconds<<std::endl;
+            return report;
+        }
+
+        size_t getShockNum(){//normals per time step
+            if(!m_prepared) prepare();
+            return m_shock_num;
+        }
+
+        size_t getDriftFactorNum(){
+            if(!m_prepared) prepare();
+            return m_corr_factor_num;
+        }
+
+    private:
+        template <class U> friend class LiborRateSimulation;//precision twins read each other's setup
+
+        //evolves W paths at once, paths in lanes: F[j*W+l] is rate j of lane l, shocks[(i*shock_num+f)*W+l],
+        //D the deflated bonds prod_{k<=j} 1/(1+tau*F_k) laid out like F, S is scratchNum()*W scratch starting with
+        //the running drift sums; W == 1 is the plain one path kernel; history and discount_history, if not null,
+        //receive the rates and bonds after every step
+        template <size_t W>
+        __attribute__((always_inline)) inline void evolveLanes(const T* __restrict shocks, T* __restrict F, T* __restrict D,
+                                                               T* __restrict S, T* __restrict history,
+                                                               T* __restrict discount_history) const{
+            const size_t n = m_num_rates, m = m_corr_factor_num, d = m_shock_num;
+            const T tau = m_rate_freq;
+            T* __restrict R = S + m*W;//1/(1+tau*F_j) of the current rates: one division gives drift and bonds
+            T* __restrict mu_start = R + n*W;//predictor-corrector: drift of the start of step rates,
+            T* __restrict dw_step = mu_start + n*W;//the Brownian increments and the predicted rates
+            T* __restrict F_hat = dw_step + n*W;
+            for(size_t j = 0; j < n; ++j){
+                for(size_t l = 0; l < W; ++l){
+                    F[j*W+l] = m_init_rates[j];
+                    R[j*W+l] = 1/(1 + tau*F[j*W+l]);
+                    D[j*W+l] = (j ? D[(j-1)*W+l] : T(1))*R[j*W+l];
+                }
+            }
+
+            for(unsigned long i = 0; i < m_num_time_steps;++i){//time step
+                const T* drift_load = &m_drift_load[i*m_drift_load_stride];
+                const T* vol_sqrt_dt = &m_vol_sqrt_dt[i*n];
+                const T* ito = &m_ito[i*n];
+                const T* z = &shocks[i*d*W];
+                const T dt = m_step_dt[i];
+                std::fill(S, S + m*W, T(0));
+                //drift: sum_k<=j corr(j,k)*vol(j)*vol(k)*tau*F_k/(1+tau*F_k)*dt = dt*sum_f A_jf*S_f with S_f running
+                //over k. Log-Euler: rates k<j enter already moved in this step, rate j itself at its start of step value.
+                //Predictor-corrector: a first pass moves every rate with the drift of the start of step rates, a
+                //second one with the average of that drift and the drift of the predicted rates.
+                for(size_t j = 0; j < n; ++j){
+                    const T* A = &drift_load[j*m];
+                    T* Fj = &F[j*W];
+                    T* Rj = &R[j*W];
+                    T* Dj = &D[j*W];
+                    const T* D_prev = j ? &D[(j-1)*W] : nullptr;
+                    T x[W], mu[W], dw[W];
+                    for(size_t l = 0; l < W; ++l){
+                        x[l] = Fj[l]*Rj[l];
+                        mu[l] = 0;
+                    }
+                    for(size_t f = 0; f < m; ++f){
+                        T a = A[f];
+                        for(size_t l = 0; l < W; ++l) mu[l] += a*(S[f*W+l] + a*x[l]);
+                    }
+                    rateShocks<W>(z, j, dw);
+                    const T ito_j = ito[j], vol_sqrt_dt_j = vol_sqrt_dt[j];
+                    T* Fj_new = m_predictor_corrector ? &F_hat[j*W] : Fj;
+                    for(size_t l = 0; l < W; ++l){
+                        T y = dt*mu[l] - ito_j + vol_sqrt_dt_j*dw[l];
+                        Fj_new[l] = Fj[l]*(W == 1 ? std::exp(y) : simdExp(y));//libm is quicker one lane at a time
+                    }
+                    if(m_predictor_corrector){
+                        for(size_t l = 0; l < W; ++l){
+                            mu_start[j*W+l] = mu[l];
+                            dw_step[j*W+l] = dw[l];
+                        }
+                    }
+                    else{//rates k<j are final, so the bonds of this step build up alongside
+                        for(size_t l = 0; l < W; ++l){
+                            Rj[l] = 1/(1 + tau*Fj[l]);
+                            x[l] = Fj[l]*Rj[l];
+                            Dj[l] = (D_prev ? D_prev[l] : T(1))*Rj[l];
+                        }
+                    }
+                    for(size_t f = 0; f < m; ++f){
+                        T a = A[f];
+                        for(size_t l = 0; l < W; ++l) S[f*W+l] += a*x[l];
+                    }
+                }
+                if(m_predictor_corrector){
+                    std::fill(S, S + m*W, T(0));
+                    for(size_t j = 0; j < n; ++j){
+                        const T* A = &drift_load[j*m];
+                        T* Fj = &F[j*W];
+                        const T* Fj_hat = &F_hat[j*W];
+                        T x[W], mu[W];
+                        for(size_t l = 0; l < W; ++l){
+                            x[l] = Fj_hat[l]/(1 + tau*Fj_hat[l]);
+                            mu[l] = 0;
+                        }
+                        for(size_t f = 0; f < m; ++f){
+                            T a = A[f];
+                            for(size_t l = 0; l < W; ++l){
+                                mu[l] += a*(S[f*W+l] + a*x[l]);
+                                S[f*W+l] += a*x[l];
+                            }
+                        }
+                        const T ito_j = ito[j], vol_sqrt_dt_j = vol_sqrt_dt[j];
+                        for(size_t l = 0; l < W; ++l){
+                            T y = T(0.5)*dt*(mu_start[j*W+l] + mu[l]) - ito_j + vol_sqrt_dt_j*dw_step[j*W+l];
+                            Fj[l] = Fj[l]*(W == 1 ? std::exp(y) : simdExp(y));
+                        }
+                        T* Rj = &R[j*W];
+                        T* Dj = &D[j*W];
+                        const T* D_prev = j ? &D[(j-1)*W] : nullptr;
+                        for(size_t l = 0; l < W; ++l){
+                            Rj[l] = 1/(1 + tau*Fj[l]);
+                            Dj[l] = (D_prev ? D_prev[l] : T(1))*Rj[l];
+                        }
+                    }
+                }
+                if(history) std::copy(F, F + n*W, history + i*n*W);
+                if(discount_history) std::copy(D, D + n*W, discount_history + i*n*W);
+            }
+        }
+
+        //Brownian increments of rate j per unit vol and sqrt(dt) from the normals z of one step, W lanes
+        template <size_t W>
+        __attribute__((always_inline)) inline void rateShocks(const T* __restrict z, size_t j, T* __restrict dw) const{
+            if(m_factor_num == 0){
+                for(size_t l = 0; l < W; ++l) dw[l] = z[j*W+l];
+                return;
+            }
+            const T* B = &m_shock_load[j*m_shock_num];
+            for(size_t l = 0; l < W; ++l) dw[l] = 0;
+            for(size_t f = 0; f < m_shock_num; ++f){
+                T b = B[f];
+                for(size_t l = 0; l < W; ++l) dw[l] += b*z[f*W+l];
+            }
+        }
+
+        size_t scratchNum() const{//per lane scratch of the path kernel
+            return m_corr_factor_num + m_num_rates + (m_predictor_corrector ? 3*m_num_rates : 0);
+        }
+
+        //Brownian increment of rate j from the normals z of one step, lane l of lanes
+        T rateShock(const T* z, size_t j, size_t lanes, size_t l) const{
+            if(m_factor_num == 0) return z[j*lanes+l];
+            T dw = 0;
+            for(size_t f = 0; f < m_shock_num; ++f) dw += m_shock_load[j*m_shock_num+f]*z[f*lanes+l];
+            return dw;
+        }
+
+        //F_j(0)*exp(sum_i vol*sqrt(dt)*z - 0.5*vol^2*dt): the forwards without drift, a martingale control
+        void driftlessForwards(const T* shocks, T* controls, size_t lanes) const{
+            const size_t n = m_num_rates, d = m_shock_num;
+            for(size_t j = 0; j < n; ++j){
+                for(size_t l = 0; l < lanes; ++l){
+                    T log_growth = 0;
+                    for(unsigned long i = 0; i < m_num_time_steps; ++i){
+                        log_growth += m_vol_sqrt_dt[i*n+j]*rateShock(&shocks[i*d*lanes], j, lanes, l) - m_ito[i*n+j];
+                    }
+                    controls[j*lanes+l] = m_init_rates[j]*std::exp(log_growth);
+                }
+            }
+        }
+
+        //lane width of each instruction set: 4/8 doubles or 8/16 floats per register
+        size_t laneNum(SimdLevel level) const{
+            switch(level){
+                case SimdLevel::Avx512:
+                    return 64/sizeof(T);
+                case SimdLevel::Avx2:
+                    return 32/sizeof(T);
+                default:
+                    return 1;
+            }
+        }
+
+#if defined(__x86_64__) || defined(__i386__)
+        __attribute__((target("avx512f"))) void evolveAvx512(const T* shocks, T* F, T* D, T* S, T* history,
+                                                             T* discount_history) const{
+            evolveLanes<64/sizeof(T)>(shocks, F, D, S, history, discount_history);
+        }
+
+        __attribute__((target("avx2,fma"))) void evolveAvx2(const T* shocks, T* F, T* D, T* S, T* history,
+                                                            T* discount_history) const{
+            evolveLanes<32/sizeof(T)>(shocks, F, D, S, history, discount_history);
+        }
+#endif
+
+        void evolve(SimdLevel level, const T* shocks, T* F, T* D, T* S, T* history, T* discount_history) const{
+#if defined(__x86_64__) || defined(__i386__)
+            if(level == SimdLevel::Avx512) return evolveAvx512(shocks, F, D, S, history, discount_history);
+            if(level == SimdLevel::Avx2) return evolveAvx2(shocks, F, D, S, history, discount_history);
+#endif
+            evolveLanes<1>(shocks, F, D, S, history, discount_history);
+        }
+
+        void prepare(){//flat per step tables read by the path kernel
+            if(m_corr_factor_num == 0) factorCorr();
+            const size_t n = m_num_rates, m = m_corr_factor_num;
+            const double drift_scale = sqrt(m_rate_freq);
+            bool time_dependent = static_cast<bool>(m_vol_surface);
+            m_vol_sqrt_dt.assign(m_num_time_steps*n, 0.0);
+            m_ito.assign(m_num_time_steps*n, 0.0);
+            m_drift_load_stride = time_dependent ? n*m : 0;//time homogeneous vols share one drift table
+            m_drift_load.assign(time_dependent ? m_num_time_steps*n*m : n*m, 0.0);
+            m_step_dt.resize(m_num_time_steps);
+            for(unsigned long i = 0; i < m_num_time_steps; ++i){
+                double t = i ? m_step_times[i-1] : 0.0, dt = m_step_times[i] - t;
+                m_step_dt[i] = dt;
+                for(size_t j = 0; j < n; ++j){
+                    double sigma = time_dependent ? m_vol_surface(t, (j+1)*m_rate_freq) : m_sigma[j];
+                    m_vol_sqrt_dt[i*n+j] = sigma*sqrt(dt);
+                    m_ito[i*n+j] = 0.5*sigma*sigma*dt;
+                    if(time_dependent || i == 0){//vol_j*vol_k*corr_jk*tau = sum_f A_jf*A_kf
+                        for(size_t f = 0; f < m; ++f){
+                            m_drift_load[i*m_drift_load_stride + j*m + f] = drift_scale*sigma*m_corr_factor[j*m+f];
+                        }
+                    }
+                }
+            }
+            m_prepared = true;
+        }
+
+        void factorCorr(){//corr ~ B*B^T keeping the leading eigenvectors, m_factor_num of them when set
+            std::vector<std::vector<double>> corr(m_num_rates, std::vector<double>(m_num_rates));
+            for(int i = 0; i < m_num_rates; ++i){
+                for(int j = 0; j < m_num_rates; ++j) corr[i][j] = m_corr[i][j];
+            }
+            std::vector<double> values;
+            std::vector<std::vector<double>> vectors;
+            symmetricEigen(corr, values, vectors);
+            double trace = 0, kept = 0;
+            for(double v : values) trace += std::max(v, 0.0);
+            size_t m = 0;
+            if(m_factor_num) while(m < std::min(m_factor_num, values.size()) && values[m] > 0) ++m;
+            else while(m < values.size() && values[m] > 0 && (m == 0 || trace - kept > m_drift_tol*trace)) kept += values[m++];
+            m_corr_factor_num = std::max<size_t>(m, 1);
+            m_corr_factor.assign(m_num_rates*m_corr_factor_num, 0.0);
+            for(int j = 0; j < m_num_rates; ++j){
+                double norm = 0;
+                for(size_t f = 0; f < m_corr_factor_num; ++f){
+                    m_corr_factor[j*m_corr_factor_num+f] = sqrt(std::max(values[f], 0.0))*vectors[j][f];
+                    norm += m_corr_factor[j*m_corr_factor_num+f]*m_corr_factor[j*m_corr_factor_num+f];
+                }
+                if(m_factor_num == 0 || norm <= 0) continue;
+                for(size_t f = 0; f < m_corr_factor_num; ++f){//unit diagonal: each rate keeps its full vol
+                    m_corr_factor[j*m_corr_factor_num+f] /= sqrt(norm);
+                }
+            }
+            m_shock_num = m_factor_num ? m_corr_factor_num : m_num_rates;
+            m_shock_load.assign(m_corr_factor.begin(), m_corr_factor.end());
+        }
+
+        size_t calibrationThreadNum(size_t start_num) const{
+            size_t thread_num = m_thread_num ? m_thread_num : std::max(1u, std::thread::hardware_concurrency());
+            return std::min(thread_num, start_num);
+        }
+
+        size_t threadNum() const{
+            size_t thread_num = m_thread_num ? m_thread_num : std::max(1u, std::thread::hardware_concurrency());
+            return std::min<size_t>(thread_num, std::max<size_t>(m_simulation_nums, 1));
+        }
+
+        //simulates every path on the pool, visit(worker_id, path_view) runs on the worker
+        //runs paths [path_begin, path_end) into the registered reducers: each chunk is reduced on its own and
+        //merged strictly in chunk order, so the sums do not depend on which worker ran which chunk
+        void streamPaths(size_t path_begin, size_t path_end){
+            typedef std::vector<std::unique_ptr<PathReducer<T>>> ReducerSet;
+            auto fresh = [this](){
+                ReducerSet local;
+                for(auto reducer : m_reducers) local.push_back(reducer->clone());
+                return local;
+            };
+            std::vector<ReducerSet> worker_reducers(threadNum());
+            for(auto& local : worker_reducers) local = fresh();
+            OrderedMerge<ReducerSet> ordered;
+            size_t next_checkpoint = path_begin + m_checkpoint_interval;
+            std::exception_ptr checkpoint_error;//workers cannot throw, the first failure is raised after the run
+            bool history = false;
+            for(auto reducer : m_reducers) history = history || reducer->needsHistory();
+            runPaths([&](size_t worker_id, const PathView<T>& view){
+                for(auto& reducer : worker_reducers[worker_id]) reducer->observePath(view);
+            }, [&](size_t worker_id, size_t chunk){
+                ReducerSet done = fresh();
+                done.swap(worker_reducers[worker_id]);
+                ordered.add(chunk, std::move(done), [&](size_t merged, ReducerSet& reducers){
+                    for(size_t r = 0; r < m_reducers.size(); ++r) m_reducers[r]->merge(*reducers[r]);
+                    m_paths_done = std::min(path_begin + (merged + 1)*m_chunk_paths, path_end);
+                    if(!m_checkpoint_file.empty() && m_paths_done >= next_checkpoint && m_paths_done < path_end){
+                        try{
+                            saveCheckpoint(m_checkpoint_file);
+                        }
+                        catch(...){
+                            if(!checkpoint_error) checkpoint_error = std::current_exception();
+                        }
+                        next_checkpoint = m_paths_done + m_checkpoint_interval;
+                    }
+                });
+            }, history, path_begin, path_end);
+            if(checkpoint_error) std::rethrow_exception(checkpoint_error);
+            if(!m_checkpoint_file.empty()) saveCheckpoint(m_checkpoint_file);
+        }
+
+        //settings a checkpoint is only valid for; the curve, grid, vol and correlation enter through one hash of
+        //their inputs and of the prepared step tables, which also cover a vol surface and the drift factors
+        std::vector<uint64_t> checkpointFields() const{
+            uint64_t hash = hashValues(0, &m_rate_freq, 1);
+            hash = hashValues(hash, m_init_rates.data(), m_init_rates.size());
+            hash = hashValues(hash, m_step_times.data(), m_step_times.size());
+            hash = hashValues(hash, m_vol_params.data(), m_vol_params.size());
+            hash = hashValues(hash, m_corr_params.data(), m_corr_params.size());
+            hash = hashValues(hash, m_vol_sqrt_dt.data(), m_vol_sqrt_dt.size());
+            hash = hashValues(hash, m_drift_load.data(), m_drift_load.size());
+            hash = hashValues(hash, m_shock_load.data(), m_shock_load.size());
+            return {static_cast<uint64_t>(m_num_rates), m_num_time_steps,
+                    m_shock_num, m_factor_num, m_antithetic, static_cast<uint64_t>(m_shock_source), m_predictor_corrector,
+                    m_control_variates, m_reducers.size(), sizeof(T), static_cast<bool>(m_vol_surface), hash};
+        }
+
+        template <class Visitor>
+        void runPaths(Visitor visit){
+            runPaths(visit, [](size_t, size_t){}, false, 0, m_simulation_nums);
+        }
+
+        //simulates paths [path_begin, path_end); chunk_done(worker_id, chunk) follows the last visit of chunk number
+        //chunk, i.e. paths from path_begin + chunk*m_chunk_paths. A run starting past path 0 extends the last run
+        //and keeps its key.
+        template <class Visitor, class ChunkDone>
+        void runPaths(Visitor visit, ChunkDone chunk_done, bool history, size_t path_begin, size_t path_end){
+            if(m_antithetic && path_end % 2) throw std::runtime_error("antithetic runs need an even path number");
+            auto run_start = std::chrono::steady_clock::now();
+            size_t thread_num = threadNum();
+            m_profile = RunProfile();
+            SimdLevel level = getSimdLevel();
+            size_t lanes = laneNum(level);
+            std::vector<Workspace> workspace;
+            static std::random_device rd;
+            //all workers share one key; the shocks of a path depend only on the key and the path number
+            uint64_t key = path_begin > 0 ? m_run_key : m_seeded ? m_seed : (uint64_t(rd()) << 32) | rd();
+            {
+                ScopedPhase phase(m_profiling ? &m_profile : nullptr, RunProfile::Setup);
+                if(!m_prepared) prepare();
+                m_run_key = key;
+                if(path_begin == 0) m_paths_done = 0;
+                workspace = makeWorkspaces(thread_num, key, lanes, scratchNum(), history);
+            }
+
+            ThreadPool& pool = m_pool.get(thread_num);
+            pool.parallelFor(path_begin, path_end, m_chunk_paths, [&](size_t worker_id, size_t chunk_begin, size_t chunk_end){
+                Workspace& ws = workspace[worker_id];
+                RunProfile* profile = m_profiling ? &ws.profile : nullptr;
+                uint64_t counters_start[3];
+                if(profile && m_hardware_counters){
+                    if(!ws.perf) ws.perf.reset(new PerfCounters());//opened by the thread it counts
+                    ws.perf->read(counters_start);
+                }
+                if(ws.sobol) ws.sobol->skipTo(m_antithetic ? chunk_begin/2 : chunk_begin);
+                for(size_t i = chunk_begin; i < chunk_end; i += lanes){//one group of SIMD lanes at a time
+                    {
+                        ScopedPhase phase(profile, RunProfile::Shocks);
+                        fillShocks(ws, ws.shocks.data(), ws.shocks.data(), i, chunk_end, lanes);
+                    }
+                    {
+                        ScopedPhase phase(profile, RunProfile::Kernel);
+                        evolve(level, ws.shocks.data(), ws.rates.data(), ws.discounts.data(), ws.partial.data(),
+                               history ? ws.history.data() : nullptr, history ? ws.discount_history.data() : nullptr);
+                    }
+                    if(m_control_variates){
+                        ScopedPhase phase(profile, RunProfile::Controls);
+                        driftlessForwards(ws.shocks.data(), ws.controls.data(), lanes);
+                    }
+                    ScopedPhase phase(profile, RunProfile::Reducers);
+                    for(size_t l = 0; l < lanes && i + l < chunk_end; ++l){
+                        visit(worker_id, laneView(i + l, l, lanes, ws.shocks.data(), ws.rates.data(), ws.discounts.data(),
+                                                  m_control_variates ? ws.controls.data() : nullptr,
+                                                  history ? ws.history.data() : nullptr,
+                                                  history ? ws.discount_history.data() : nullptr));
+                    }
+                    if(profile){
+                        ++profile->lane_groups;
+                        profile->paths += std::min(lanes, chunk_end - i);
+                    }
+                }
+                {
+                    ScopedPhase phase(profile, RunProfile::Merge);
+                    chunk_done(worker_id, (chunk_begin - path_begin)/m_chunk_paths);
+                }
+                if(profile){
+                    ++profile->chunks;
+                    if(ws.perf && ws.perf->valid()){
+                        uint64_t counters_end[3];
+                        ws.perf->read(counters_end);
+                        profile->cycles += counters_end[0] - counters_start[0];
+                        profile->instructions += counters_end[1] - counters_start[1];
+                        profile->cache_misses += counters_end[2] - counters_start[2];
+                    }
+                }
+            });
+            if(m_profiling){
+                m_profile.thread_num = thread_num;
+                m_profile.hardware = m_hardware_counters;
+                for(const Workspace& ws : workspace){
+                    m_profile.add(ws.profile);
+                    m_profile.slow_draws += ws.rand_gen.rejectCount();
+                    m_profile.workspace_bytes += ws.bytes();
+                    if(ws.profile.chunks) m_profile.hardware = m_profile.hardware && ws.perf && ws.perf->valid();
+                }
+                //live lanes only: padding lanes of a chunk's last group are not paths. The kernel moves every forward
+                //on every step, fixed ones too since the bonds read them, once per pass of the scheme
+                m_profile.exp_calls = m_profile.paths*m_num_time_steps*m_num_rates*(m_predictor_corrector ? 2 : 1);
+                m_profile.wall_seconds = std::chrono::duration<double>(std::chrono::steady_clock::now() - run_start).count();
+            }
+        }
+
+        struct Workspace{//per worker state reused across paths
+            Workspace(uint64_t seed, size_t shock_num, size_t rate_num, size_t partial_num)
+            :rand_gen(seed),shocks(shock_num),rates(rate_num),discounts(rate_num),controls(rate_num),partial(partial_num){};
+            NormalBlockGenerator<T> rand_gen;
+            std::unique_ptr<SobolBridgeGenerator<T>> sobol;//only for ShockSource::Sobol
+            AlignedVector<T> shocks;
+            AlignedVector<T> rates;
+            AlignedVector<T> discounts;
+            AlignedVector<T> controls;
+            AlignedVector<T> partial;
+            AlignedVector<T> history;//only when a reducer needsHistory()
+            AlignedVector<T> discount_history;
+            RunProfile profile;//this worker's share, only filled with setProfiling
+            std::unique_ptr<PerfCounters> perf;
+
+            size_t bytes() const{
+                return (shocks.size() + rates.size() + discounts.size() + controls.size() + partial.size() + history.size()
+                        + discount_history.size())*sizeof(T);
+            }
+        };
+
+        //shocks of the group of lanes starting at path i; with antithetic pairs odd paths mirror the path before:
+        //chunks start even and lanes come in even numbers, so that path sits in the previous lane or, one lane
+        //wide, in previous, the buffer of the group before
+        void fillShocks(Workspace& ws, T* shocks, const T* previous, size_t i, size_t chunk_end, size_t lanes) const{
+            const size_t step_shocks = m_num_time_steps*m_shock_num;
+            bool mirror_only = m_antithetic && lanes == 1 && i % 2;
+            if(ws.sobol){
+                for(size_t l = 0; l < lanes; ++l){
+                    if(!(m_antithetic && (i + l) % 2)) ws.sobol->fill(&shocks[l], lanes);//point i+l in lane l
+                }
+            }
+            else if(!mirror_only){
+                for(size_t l = 0; l < lanes && i + l < chunk_end; ++l){//path i+l in lane l
+                    if(m_antithetic && (i + l) % 2) continue;
+                    ws.rand_gen.fill(m_antithetic ? (i + l)/2 : i + l, &shocks[l], step_shocks, lanes);
+                }
+            }
+            if(m_antithetic){
+                for(size_t l = 0; l < lanes; ++l){
+                    if((i + l) % 2 == 0) continue;
+                    const T* from = lanes == 1 ? previous : &shocks[l-1];
+                    for(size_t k = 0; k < step_shocks*lanes; k += lanes) shocks[k+l] = -from[k];
+                }
+            }
+        }
+
+        //lane l of a group of lanes paths; controls and the histories may be null
+        PathView<T> laneView(size_t path, size_t l, size_t lanes, const T* shocks, const T* rates, const T* discounts,
+                             const T* controls, const T* history, const T* discount_history) const{
+            PathView<T> view{path, &rates[l], static_cast<size_t>(m_num_rates), lanes};
+            view.antithetic = m_antithetic;
+            view.discounts = &discounts[l];
+            if(controls) view.controls = &controls[l];
+            if(history){
+                view.history = &history[l];
+                view.discount_history = &discount_history[l];
+            }
+            view.shocks = &shocks[l];
+            return view;
+        }
+
+        std::vector<Workspace> makeWorkspaces(size_t thread_num, uint64_t key, size_t lanes, size_t scratch_num, bool history) const{
+            std::vector<Workspace> workspace;//one generator and set of buffers per worker, never shared
+            workspace.reserve(thread_num);
+            for(size_t w = 0; w < thread_num; ++w){
+                workspace.emplace_back(key, m_num_time_steps*m_shock_num*lanes, m_num_rates*lanes, scratch_num*lanes);
+                if(history){
+                    workspace.back().history.resize(m_num_time_steps*m_num_rates*lanes);
+                    workspace.back().discount_history.resize(m_num_time_steps*m_num_rates*lanes);
+                }
+            }
+            if(m_shock_source == ShockSource::Sobol){
+                uint64_t scramble_seed = key + 1;//same scramble for all workers
+                for(auto& ws : workspace) ws.sobol.reset(new SobolBridgeGenerator<T>(m_shock_num, m_step_times, scramble_seed));
+            }
+            return workspace;
+        }
+
+        RateInterpolation m_ri;
+
+        size_t m_simulation_nums;
+
+        //simulation steps
+        double m_projection_years;//simulation years
+        unsigned long m_num_time_steps;//number of steps
+        double m_dt;//length of simulation step, the average one on a custom grid
+        std::vector<double> m_step_times;//end of every step
+        std::vector<double> m_step_dt;
+        bool m_predictor_corrector = false;
+
+        //Libor Curves
+        double m_maturity;//time to maturity of Libor Curve
+        double m_rate_freq;//libor frequency
+        int m_num_rates;//number of Libor rates
+
+        //parallel run
+        size_t m_thread_num = 0;//0 means hardware concurrency
+        PoolSlot m_pool;//workers kept across runs
+        static const size_t m_chunk_paths = 256;//unit of work stealing and of ordered reduction
+        unsigned int m_seed = 0;
+        uint64_t m_run_key = 0;//Philox key of the last run, drawn from random_device when not seeded
+        size_t m_paths_done = 0;//paths of the current run merged into the reducers
+        std::string m_checkpoint_file;
+        size_t m_checkpoint_interval = 0;
+        bool m_seeded = false;
+
+        std::vector<T> m_init_rates;
+        std::vector<std::vector<T>> m_corr;//correlation matrix
+        std::vector<T> m_sigma;//rate vol
+
+        std::array<double, 4> m_vol_params{};//a, b, c, d of setVol
+        std::array<double, 3> m_corr_params{};//rho_inf, lambda, kai of setCorr
+        std::function<double(double, double)> m_vol_surface;//empty for the time homogeneous setVol form
+
+        //correlation factors, rebuilt when the correlation changes
+        double m_drift_tol = 1e-4;
+        size_t m_factor_num = 0;//principal components driving the shocks, 0 for one independent normal per rate
+        size_t m_shock_num = 0;//normals per time step
+        AlignedVector<T> m_shock_load;//unit variance factor loadings, num_rates*shock_num when m_factor_num is set
+        size_t m_corr_factor_num = 0;
+        std::vector<double> m_corr_factor;//num_rates*corr_factor_num
+
+        //per step tables, rebuilt when vol or correlation change
+        bool m_prepared = false;
+        AlignedVector<T> m_vol_sqrt_dt;//num_time_steps*num_rates
+        AlignedVector<T> m_ito;//0.5*vol^2*dt, num_time_steps*num_rates
+        AlignedVector<T> m_drift_load;//per step num_rates*corr_factor_num, or one block if vols are time homogeneous
+        size_t m_drift_load_stride = 0;
+        SimdLevel m_simd_level = SimdLevel::Auto;
+        ShockSource m_shock_source = ShockSource::PseudoRandom;
+        bool m_antithetic = false;
+        bool m_control_variates = false;
+
+        std::vector<std::vector<T>> m_output;//only filled by LiborSimulation()
+        std::vector<PathReducer<T>*> m_reducers;
+
+        bool m_profiling = false;
+        bool m_hardware_counters = false;
+        RunProfile m_profile;//of the last run
+    };
+}
+
+class LiborRateSimulationTest {
+public:
+
+    static void testThreadPoolException(){
+        //a throwing chunk stops the loop and reaches the caller, whichever worker ran it
+        simulationlib::ThreadPool pool(4);
+        for(size_t bad_chunk : {0, 5, 63}){
+            bool thrown = false;
+            try{
+                pool.parallelFor(0, 64*16, 16, [&](size_t, size_t chunk_begin, size_t){
+                    if(chunk_begin == bad_chunk*16) throw std::runtime_error("chunk failed");
+                });
+            }
+            catch(const std::runtime_error&){
+                thrown = true;
+            }
+            BOOST_ASSERT_MSG(thrown, "parallelFor does not rethrow a task exception");
+        }
+        std::atomic<size_t> sum{0};//the pool stays usable
+        pool.parallelFor(0, 100, 10, [&](size_t, size_t chunk_begin, size_t chunk_end){
+            for(size_t i = chunk_begin; i < chunk_end; ++i) sum += i;
+        });
+        BOOST_ASSERT_MSG(sum == 4950, "parallelFor after an exception is not correct");
+    }
+
+    static void testThreadNumDoesNotChangeResults(){
+        //every path depends only on the seed and its number and chunks merge in order, so the reduced statistics
+        //are bit for bit those of one thread
+        std::vector<double> init_rates {0.0005, 0.0006, 0.0007, 0.0009, 0.001,0.0016, 0.0023,0.0049,0.0082,0.0115,0.0169, 0.0188};
+        std::vector<double> init_tenors {1.0/12.0, 1.0/6.0, 0.25, 0.5, 1,2,3,5,7,10,20,30};
+        double maturity = 5, tau = 0.25;
+        size_t n = static_cast<size_t>(maturity/tau) - 1;
+        for(simulationlib::ShockSource source : {simulationlib::ShockSource::PseudoRandom, simulationlib::ShockSource::Sobol}){
+            std::vector<double> reference;
+            for(size_t thread_num : {1, 3, 8}){
+                simulationlib::LiborRateSimulation<double> lmm{3000, 2, 8, maturity, tau, init_rates, init_tenors};
+                lmm.setVol(0.19, 0.97, 0.08, 0.01);
+                lmm.setCorr(0.99, 0.5, 0.5);
+                lmm.setInitRate();
+                lmm.setSeed(42);
+                lmm.setShockSource(source);
+                lmm.setAntithetic(true);
+                lmm.setThreadNum(thread_num);
+                simulationlib::VarianceReducer<double> stats(n);
+                simulationlib::PricingReducer<double> prices = lmm.pricingReducer();
+                prices.addCap(0.002, 1, 7);
+                prices.addPayerSwaption(0.003, 2, 6);
+                lmm.addReducer(stats);
+                lmm.addReducer(prices);
+                lmm.LiborSimulationStream();
+
+                std::vector<double> results;
+                for(size_t j = 0; j < n; ++j){
+                    results.push_back(stats.mean(j));
+                    results.push_back(stats.variance(j));
+                }
+                for(size_t i = 0; i < prices.size(); ++i){
+                    results.push_back(prices.price(i));
+                    results.push_back(prices.stdError(i));
+                }
+                if(reference.empty()) reference = results;
+                BOOST_ASSERT_MSG(results == reference, "results depend on the thread number");
+            }
+        }
+    }
+
+    static void testSwaptionFixing(){
+        //on a 2 year grid a 1.5 year into 1.5 year swaption fixes with its first forward; caplets past 2 years cannot
+        std::vector<double> init_rates {0.0005, 0.0006, 0.0007, 0.0009, 0.001,0.0016, 0.0023,0.0049,0.0082,0.0115,0.0169, 0.0188};
+        std::vector<double> init_tenors {1.0/12.0, 1.0/6.0, 0.25, 0.5, 1,2,3,5,7,10,20,30};
+        simulationlib::LiborRateSimulation<double> lmm{512, 2, 8, 5, 0.25, init_rates, init_tenors};
+        lmm.setVol(0.19, 0.97, 0.08, 0.01);
+        lmm.setCorr(0.99, 0.5, 0.5);
+        lmm.setInitRate();
+        lmm.setSeed(1);
+        simulationlib::PricingReducer<double> prices = lmm.pricingReducer();
+        size_t swaption = prices.addPayerSwaption(0.0, 5, 11);//forward j starts at (j+1)*0.25 years
+        bool thrown = false;
+        try{
+            prices.addCap(0.0, 5, 11);
+        }
+        catch(const std::runtime_error&){
+            thrown = true;
+        }
+        BOOST_ASSERT_MSG(thrown, "caplets fixing after the grid are accepted");
+        lmm.addReducer(prices);
+        lmm.LiborSimulationStream();
+        BOOST_ASSERT_MSG(prices.price(swaption) > 0, "swaption price is not correct");
+    }
+
+    static void testDriftFromFactorSums(){
+        //the drift from running factor sums against the direct double sum over k<=j of
+        //tau*vol_j*vol_k*corr_jk*F_k/(1+tau*F_k)*dt, where the rates k<j have already moved in the step
+        std::vector<double> init_rates {0.0005, 0.0006, 0.0007, 0.0009, 0.001,0.0016, 0.0023,0.0049,0.0082,0.0115,0.0169, 0.0188};
+        std::vector<double> init_tenors {1.0/12.0, 1.0/6.0, 0.25, 0.5, 1,2,3,5,7,10,20,30};
+        double projection_years = 1.5, maturity = 5, tau = 0.25, a = 0.19, b = 0.97, c = 0.3, d = 0.01;
+        unsigned long steps = 3;
+        simulationlib::LiborRateSimulation<double> lmm{1, projection_years, steps, maturity, tau, init_rates, init_tenors};
+        lmm.setVol(a, b, c, d);
+        lmm.setCorr(0.5, 0.5, 0.5);
+        lmm.setInitRate();
+        lmm.setDriftTolerance(0.0);//every correlation factor, so the sums are exact
+        size_t n = static_cast<size_t>(maturity/tau) - 1;
+        std::vector<double> shocks(steps*n), F;
+        for(size_t k = 0; k < shocks.size(); ++k) shocks[k] = sin(1.0 + k);
+        lmm.LiborSimulationOnePath(shocks.data(), F);
+
+        simulationlib::RateInterpolation curve(init_tenors, init_rates);
+        double dt = projection_years/steps;
+        std::vector<double> G(n), vol(n);
+        for(size_t j = 0; j < n; ++j){
+            G[j] = curve.getRate((j+1)*tau, (j+2)*tau);
+            vol[j] = (a*(j+1)*tau + d)*exp(-b*(j+1)*tau) + c;
+        }
+        for(size_t i = 0; i < steps; ++i){
+            for(size_t j = 0; j < n; ++j){
+                double mu = 0.0;
+                for(size_t k = 0; k <= j; ++k){
+                    mu += tau*vol[j]*vol[k]*lmm.getCorr(j+1, k+1)*G[k]/(1 + tau*G[k])*dt;
+                }
+                G[j] *= exp(mu - 0.5*vol[j]*vol[j]*dt + vol[j]*sqrt(dt)*shocks[i*n+j]);
+            }
+        }
+        for(size_t j = 0; j < n; ++j){
+            BOOST_ASSERT_MSG(std::abs(F[j]/G[j] - 1) < 1e-12, "drift from factor sums is not correct");
+        }
+    }
+
+    static void testDriftOverOneStep(){
+        //one half year step without shocks: with the identity correlation forward j only drifts with itself,
+        //F_j = F_j(0)*exp((tau*vol_j^2*F_j(0)/(1+tau*F_j(0)) - 0.5*vol_j^2)*dt)
+        std::vector<double> init_rates {0.0005, 0.0006, 0.0007, 0.0009, 0.001,0.0016, 0.0023,0.0049,0.0082,0.0115,0.0169, 0.0188};
+        std::vector<double> init_tenors {1.0/12.0, 1.0/6.0, 0.25, 0.5, 1,2,3,5,7,10,20,30};
+        double dt = 0.5, maturity = 10, tau = 0.25, a = 0.19, b = 0.97, c = 0.3, d = 0.01;
+        simulationlib::LiborRateSimulation<double> lmm{1, dt, 1, maturity, tau, init_rates, init_tenors};
+        lmm.setVol(a, b, c, d);
+        lmm.setCorr(0.0, 1e6, 0.0);//exp(-1e6*distance) leaves the identity
+        lmm.setInitRate();
+        std::vector<double> shocks(static_cast<size_t>(maturity/tau) - 1, 0.0), F;//one normal per rate
+        lmm.LiborSimulationOnePath(shocks.data(), F);
+
+        simulationlib::RateInterpolation curve(init_tenors, init_rates);
+        BOOST_ASSERT_MSG(F.size() == shocks.size(), "one step should move every rate");
+        for(size_t j = 0; j < F.size(); ++j){
+            double F0 = curve.getRate((j+1)*tau, (j+2)*tau);
+            double vol = (a*(j+1)*tau + d)*exp(-b*(j+1)*tau) + c;
+            double expected = F0*exp((tau*vol*vol*F0/(1 + tau*F0) - 0.5*vol*vol)*dt);
+            BOOST_ASSERT_MSG(std::abs(F[j]/expected - 1) < 1e-12, "drift over one step is not correct");
+        }
+    }
+
+    static void testGreeksRejectPredictorCorrector(){
+        //the adjoint has no predictor-corrector sweep; the run must refuse before any worker starts
+        std::vector<double> init_rates {0.0005, 0.0006, 0.0007, 0.0009, 0.001,0.0016, 0.0023,0.0049,0.0082,0.0115,0.0169, 0.0188};
+        std::vector<double> init_tenors {1.0/12.0, 1.0/6.0, 0.25, 0.5, 1,2,3,5,7,10,20,30};
+        simulationlib::LiborRateSimulation<double> lmm{512, 2, 8, 5, 0.25, init_rates, init_tenors};
+        lmm.setVol(0.19, 0.97, 0.08, 0.01);
+        lmm.setCorr(0.99, 0.5, 0.5);
+        lmm.setInitRate();
+        lmm.setSeed(1);
+        lmm.setThreadNum(4);
+        lmm.setPredictorCorrector(true);
+        std::vector<double> delta, vega;
+        bool thrown = false;
+        try{
+            lmm.LiborSimulationGreeks([](const std::vector<double>& F, std::vector<double>& F_bar){
+                F_bar[0] = 1.0;
+                return F[0];
+            }, delta, vega);
+        }
+        catch(const std::runtime_error&){
+            thrown = true;
+        }
+        BOOST_ASSERT_MSG(thrown, "predictor-corrector Greeks are accepted");
+    }
+
+    static void testGreeksAgainstFiniteDifferences(){
+        //with a fixed seed every bumped run sees the same shocks, so central differences of the price match the
+        //averaged pathwise Greeks; a parallel shift of the zero curve moves every forward by the same amount
+        std::vector<double> init_rates {0.0005, 0.0006, 0.0007, 0.0009, 0.001,0.0016, 0.0023,0.0049,0.0082,0.0115,0.0169, 0.0188};
+        std::vector<double> init_tenors {1.0/12.0, 1.0/6.0, 0.25, 0.5, 1,2,3,5,7,10,20,30};
+        std::vector<double> params {0.19, 0.97, 0.08, 0.01};
+        auto price = [&](double shift, const std::vector<double>& vol, std::vector<double>& delta, std::vector<double>& vega){
+            std::vector<double> rates(init_rates);
+            for(double& r : rates) r += shift;
+            simulationlib::LiborRateSimulation<double> lmm{256, 2, 8, 5, 0.25, rates, init_tenors};
+            lmm.setVol(vol[0], vol[1], vol[2], vol[3]);
+            lmm.setCorr(0.99, 0.5, 0.5);
+            lmm.setInitRate();
+            lmm.setSeed(3);
+            lmm.setAntithetic(true);
+            lmm.setThreadNum(4);
+            return lmm.LiborSimulationGreeks([](const std::vector<double>& F, std::vector<double>& F_bar){
+                F_bar[6] = F[12];
+                F_bar[12] = F[6];
+                return F[6]*F[12];
+            }, delta, vega);
+        };
+        std::vector<double> delta, vega, unused_delta, unused_vega;
+        double value = price(0.0, params, delta, vega), h = 1e-6;
+        double delta_sum = 0.0;
+        for(double x : delta) delta_sum += x;
+        double delta_fd = (price(h, params, unused_delta, unused_vega) - price(-h, params, unused_delta, unused_vega))/(2*h);
+        BOOST_ASSERT_MSG(value > 0 && std::abs(delta_fd/delta_sum - 1) < 1e-5, "adjoint deltas are not correct");
+        for(size_t p = 0; p < 4; ++p){
+            std::vector<double> up(params), down(params);
+            up[p] += h;
+            down[p] -= h;
+            double vega_fd = (price(0.0, up, unused_delta, unused_vega) - price(0.0, down, unused_delta, unused_vega))/(2*h);
+            BOOST_ASSERT_MSG(std::abs(vega_fd - vega[p]) < 1e-5*std::abs(vega[p]), "adjoint vegas are not correct");
+        }
+    }
+
+    static void testCheckpointRejectsOtherSettings(){
+        //a checkpoint or shard of one model must not resume or merge into a model with another curve or vol
+        std::vector<double> init_rates {0.0005, 0.0006, 0.0007, 0.0009, 0.001,0.0016, 0.0023,0.0049,0.0082,0.0115,0.0169, 0.0188};
+        std::vector<double> init_tenors {1.0/12.0, 1.0/6.0, 0.25, 0.5, 1,2,3,5,7,10,20,30};
+        size_t n = 19;
+        auto model = [&](double shift, double c){
+            std::vector<double> rates(init_rates);
+            for(double& r : rates) r += shift;
+            simulationlib::LiborRateSimulation<double> lmm{512, 2, 8, 5, 0.25, rates, init_tenors};
+            lmm.setVol(0.19, 0.97, c, 0.01);
+            lmm.setCorr(0.99, 0.5, 0.5);
+            lmm.setInitRate();
+            lmm.setSeed(5);
+            return lmm;
+        };
+        simulationlib::LiborRateSimulation<double> saved = model(0.0, 0.08);
+        simulationlib::VarianceReducer<double> saved_stats(n);
+        saved.addReducer(saved_stats);
+        saved.LiborSimulationStream();
+        saved.saveCheckpoint("rate_simulation_test.ckpt");
+        saved.simulateShard(0, 1, "rate_simulation_test.shard");
+
+        simulationlib::LiborRateSimulation<double> same = model(0.0, 0.08);
+        simulationlib::VarianceReducer<double> same_stats(n);
+        same.addReducer(same_stats);
+        same.resume("rate_simulation_test.ckpt");
+        BOOST_ASSERT_MSG(same_stats.mean(3) == saved_stats.mean(3), "checkpoint of the same model is not restored");
+
+        for(std::pair<double, double> other : {std::make_pair(0.0, 0.09), std::make_pair(1e-4, 0.08)}){
+            simulationlib::LiborRateSimulation<double> lmm = model(other.first, other.second);
+            simulationlib::VarianceReducer<double> stats(n);
+            lmm.addReducer(stats);
+            bool resume_thrown = false, merge_thrown = false;
+            try{
+                lmm.resume("rate_simulation_test.ckpt");
+            }
+            catch(const std::runtime_error&){
+                resume_thrown = true;
+            }
+            try{
+                lmm.mergeShards({"rate_simulation_test.shard"});
+            }
+            catch(const std::runtime_error&){
+                merge_thrown = true;
+            }
+            BOOST_ASSERT_MSG(resume_thrown && merge_thrown, "checkpoint of another model is accepted");
+        }
+        std::remove("rate_simulation_test.ckpt");
+        std::remove("rate_simulation_test.shard");
+    }
+
+    static void testShardedMatchesStream(){
+        //shards merged chunk by chunk repeat the sums of one process bit for bit; shards that leave out paths
+        //are rejected
+        std::vector<double> init_rates {0.0005, 0.0006, 0.0007, 0.0009, 0.001,0.0016, 0.0023,0.0049,0.0082,0.0115,0.0169, 0.0188};
+        std::vector<double> init_tenors {1.0/12.0, 1.0/6.0, 0.25, 0.5, 1,2,3,5,7,10,20,30};
+        size_t n = 19;
+        for(simulationlib::ShockSource source : {simulationlib::ShockSource::PseudoRandom, simulationlib::ShockSource::Sobol}){
+            std::vector<std::vector<double>> results;
+            for(size_t process_num : {0, 1, 3}){//0 runs LiborSimulationStream
+                simulationlib::LiborRateSimulation<double> lmm{3000, 2, 8, 5, 0.25, init_rates, init_tenors};
+                lmm.setVol(0.19, 0.97, 0.08, 0.01);
+                lmm.setCorr(0.99, 0.5, 0.5);
+                lmm.setInitRate();
+                lmm.setSeed(11);
+                lmm.setShockSource(source);
+                lmm.setAntithetic(true);
+                lmm.setThreadNum(2);
+                simulationlib::VarianceReducer<double> stats(n);
+                simulationlib::PricingReducer<double> prices = lmm.pricingReducer();
+                prices.addCap(0.002, 1, 7);
+                lmm.addReducer(stats);
+                lmm.addReducer(prices);
+                if(process_num) lmm.LiborSimulationSharded(process_num, "rate_simulation_test");
+                else lmm.LiborSimulationStream();
+
+                std::vector<double> result;
+                for(size_t j = 0; j < n; ++j){
+                    result.push_back(stats.mean(j));
+                    result.push_back(stats.variance(j));
+                }
+                result.push_back(prices.price(0));
+                result.push_back(prices.stdError(0));
+                results.push_back(result);
+                BOOST_ASSERT_MSG(results.back() == results.front(), "sharded run differs from one process");
+            }
+        }
+
+        simulationlib::LiborRateSimulation<double> lmm{3000, 2, 8, 5, 0.25, init_rates, init_tenors};
+        lmm.setVol(0.19, 0.97, 0.08, 0.01);
+        lmm.setCorr(0.99, 0.5, 0.5);
+        lmm.setInitRate();
+        lmm.setSeed(11);
+        simulationlib::VarianceReducer<double> stats(n);
+        lmm.addReducer(stats);
+        lmm.simulateShard(0, 2, "rate_simulation_test.0");
+        bool thrown = false;
+        try{
+            lmm.mergeShards({"rate_simulation_test.0"});
+        }
+        catch(const std::runtime_error&){
+            thrown = true;
+        }
+        std::remove("rate_simulation_test.0");
+        BOOST_ASSERT_MSG(thrown && lmm.getPathsDone() == 0, "shards missing paths are merged");
+    }
+
+    static void testStepBiasBenchmarkKeepsRun(){
+        //a benchmark between a run and its extension, even one that throws part way, leaves the extension equal
+        //to one run of the total
+        std::vector<double> init_rates {0.0005, 0.0006, 0.0007, 0.0009, 0.001,0.0016, 0.0023,0.0049,0.0082,0.0115,0.0169, 0.0188};
+        std::vector<double> init_tenors {1.0/12.0, 1.0/6.0, 0.25, 0.5, 1,2,3,5,7,10,20,30};
+        size_t n = 19;
+        std::vector<std::vector<double>> results;
+        for(bool benchmark : {false, true}){
+            simulationlib::LiborRateSimulation<double> lmm{benchmark ? 512 : 1024, 2, 8, 5, 0.25, init_rates, init_tenors};
+            lmm.setVol(0.19, 0.97, 0.08, 0.01);
+            lmm.setCorr(0.99, 0.5, 0.5);
+            lmm.setInitRate();
+            lmm.setSeed(9);
+            simulationlib::VarianceReducer<double> stats(n);
+            lmm.addReducer(stats);
+            lmm.LiborSimulationStream();
+            if(benchmark){
+                bool thrown = false;
+                try{
+                    lmm.stepBiasBenchmark({4, 0});//no grid has 0 steps
+                }
+                catch(const std::runtime_error&){
+                    thrown = true;
+                }
+                BOOST_ASSERT_MSG(thrown, "a benchmark with 0 steps is accepted");
+                lmm.stepBiasBenchmark({2});
+                lmm.extend(512);
+            }
+            std::vector<double> result;
+            for(size_t j = 0; j < n; ++j){
+                result.push_back(stats.mean(j));
+                result.push_back(stats.variance(j));
+            }
+            results.push_back(result);
+        }
+        BOOST_ASSERT_MSG(results[0] == results[1], "the step bias benchmark changes the run it follows");
+    }
+
+    static void testHistogramEdges(){
+        //just below upper the scaled offset rounds up to the bin number; it belongs to the last bin, NaN to none
+        simulationlib::HistogramReducer<double> histogram(0, -0.02, 0.04, 10);
+        for(double x : {std::nextafter(0.04, 0.0), 0.04, -0.03, std::nan("")}){
+            simulationlib::PathView<double> view{0, &x, 1, 1};
+            histogram.observePath(view);
+        }
+        BOOST_ASSERT_MSG(histogram.bins().back() == 1 && histogram.overflow() == 1 && histogram.underflow() == 1
+                         && histogram.nanCount() == 1, "histogram edges are not correct");
+    }
+
+    static void testCalibrationRoundTrip(){
+        //vols and correlations generated from known parameters give those parameters back; mismatched inputs throw
+        std::vector<double> init_rates {0.0005, 0.0006, 0.0007, 0.0009, 0.001,0.0016, 0.0023,0.0049,0.0082,0.0115,0.0169, 0.0188};
+        std::vector<double> init_tenors {1.0/12.0, 1.0/6.0, 0.25, 0.5, 1,2,3,5,7,10,20,30};
+        simulationlib::LiborRateSimulation<double> lmm{1, 2, 8, 10, 0.25, init_rates, init_tenors};
+        std::vector<double> vol_params {0.19, 0.97, 0.08, 0.01}, corr_params {0.4, 0.5, 0.3};
+        std::vector<double> expiries, caplet_vols;
+        for(double t = 0.5; t <= 10; t += 0.5){
+            expiries.push_back(t);
+            caplet_vols.push_back((vol_params[0]*t + vol_params[3])*exp(-vol_params[1]*t) + vol_params[2]);
+        }
+        std::vector<double> tenors {0.5, 1, 2, 3, 5, 7, 10};
+        std::vector<std::vector<double>> corr(tenors.size(), std::vector<double>(tenors.size()));
+        for(size_t i = 0; i < tenors.size(); ++i){
+            for(size_t j = 0; j < tenors.size(); ++j){
+                corr[i][j] = corr_params[0] + (1 - corr_params[0])*exp(-corr_params[1]*std::abs(tenors[i] - tenors[j])
+                                                                        /(1 + corr_params[2]*std::min(tenors[i], tenors[j])));
+            }
+        }
+        simulationlib::CalibrationResult vol = lmm.calibrateVol(expiries, caplet_vols);
+        simulationlib::CalibrationResult correlation = lmm.calibrateCorr(tenors, corr);
+        for(size_t k = 0; k < 4; ++k){
+            BOOST_ASSERT_MSG(std::abs(vol.params[k] - vol_params[k]) < 1e-6, "calibrated vol is not correct");
+        }
+        for(size_t k = 0; k < 3; ++k){
+            BOOST_ASSERT_MSG(std::abs(correlation.params[k] - corr_params[k]) < 1e-6, "calibrated correlation is not correct");
+        }
+
+        size_t thrown = 0;
+        auto expect_throw = [&](std::function<void()> calibrate){
+            try{
+                calibrate();
+            }
+            catch(const std::runtime_error&){
+                ++thrown;
+            }
+        };
+        expect_throw([&]{lmm.calibrateVol({}, {});});
+        expect_throw([&]{lmm.calibrateVol(expiries, std::vector<double>(caplet_vols.begin(), caplet_vols.end() - 1));});
+        expect_throw([&]{lmm.calibrateCorr(std::vector<double>(tenors.begin(), tenors.end() - 1), corr);});
+        corr.back().pop_back();
+        expect_throw([&]{lmm.calibrateCorr(tenors, corr);});
+        BOOST_ASSERT_MSG(thrown == 4, "mismatched calibration inputs are accepted");
+    }
+
+    static void testPathStoreRoundTrip(){
+        //a path store holds, column by column, the curves LiborSimulation keeps for the same seed
+        std::vector<double> init_rates {0.0005, 0.0006, 0.0007, 0.0009, 0.001,0.0016, 0.0023,0.0049,0.0082,0.0115,0.0169, 0.0188};
+        std::vector<double> init_tenors {1.0/12.0, 1.0/6.0, 0.25, 0.5, 1,2,3,5,7,10,20,30};
+        simulationlib::LiborRateSimulation<double> lmm{1000, 2, 8, 5, 0.25, init_rates, init_tenors};
+        lmm.setVol(0.19, 0.97, 0.08, 0.01);
+        lmm.setCorr(0.99, 0.5, 0.5);
+        lmm.setInitRate();
+        lmm.setSeed(13);
+        lmm.LiborSimulationToFile("rate_simulation_test.paths", true);
+        const std::vector<std::vector<double>>& curves = lmm.LiborSimulation();
+        bool same = false;
+        {
+            simulationlib::PathStoreReader<double> reader("rate_simulation_test.paths");
+            same = reader.pathNum() == curves.size() && reader.stepNum() == 8 && reader.stepTimes()[7] == lmm.getTimeGrid().back();
+            for(size_t path = 0; same && path < curves.size(); ++path){
+                for(size_t j = 0; j < reader.rateNum(); ++j) same = same && reader.value(path, 7, j) == curves[path][j];
+            }
+        }
+        std::remove("rate_simulation_test.paths");
+        BOOST_ASSERT_MSG(same, "path store does not hold the simulated paths");
+    }
+
+    static void testResumeAfterFailedRun(){
+        //a run that dies part way keeps its last interval checkpoint; resuming it gives the uninterrupted run
+        std::vector<double> init_rates {0.0005, 0.0006, 0.0007, 0.0009, 0.001,0.0016, 0.0023,0.0049,0.0082,0.0115,0.0169, 0.0188};
+        std::vector<double> init_tenors {1.0/12.0, 1.0/6.0, 0.25, 0.5, 1,2,3,5,7,10,20,30};
+        size_t n = 19;
+        std::vector<std::vector<double>> results;
+        for(int run : {0, 1, 2}){//uninterrupted, failing, resumed
+            simulationlib::LiborRateSimulation<double> lmm{4096, 2, 8, 5, 0.25, init_rates, init_tenors};
+            lmm.setVol(0.19, 0.97, 0.08, 0.01);
+            lmm.setCorr(0.99, 0.5, 0.5);
+            lmm.setInitRate();
+            lmm.setSeed(17);
+            lmm.setThreadNum(run == 1 ? 1 : 4);//one thread merges 2048 paths before path 3000 fails
+            simulationlib::VarianceReducer<double> stats(n);
+            simulationlib::PayoffReducer<double> payoff([run](const simulationlib::PathView<double>& path){
+                if(run == 1 && path.path == 3000) throw std::runtime_error("path failed");
+                return path.forward(3);
+            });
+            lmm.addReducer(stats);
+            lmm.addReducer(payoff);
+            if(run == 1){
+                lmm.setCheckpoint("rate_simulation_test.ckpt", 1024);
+                bool thrown = false;
+                try{
+                    lmm.LiborSimulationStream();
+                }
+                catch(const std::runtime_error&){
+                    thrown = true;
+                }
+                BOOST_ASSERT_MSG(thrown, "the failing run did not fail");
+                continue;
+            }
+            if(run == 2){
+                size_t resumed_from = lmm.resume("rate_simulation_test.ckpt");
+                BOOST_ASSERT_MSG(resumed_from > 0 && resumed_from < 3000, "checkpoint is not from the failed run");
+            }
+            else lmm.LiborSimulationStream();
+            std::vector<double> result {payoff.mean(), payoff.stdError()};
+            for(size_t j = 0; j < n; ++j){
+                result.push_back(stats.mean(j));
+                result.push_back(stats.variance(j));
+            }
+            results.push_back(result);
+        }
+        std::remove("rate_simulation_test.ckpt");
+        BOOST_ASSERT_MSG(results[0] == results[1], "resumed run differs from the uninterrupted one");
+    }
+
+    static void testFloatTwin(){
+        //the float twin draws the paths of the double simulation: terminal rates agree to float precision and
+        //caplet prices to a tiny share of their standard error
+        std::vector<double> init_rates {0.0005, 0.0006, 0.0007, 0.0009, 0.001,0.0016, 0.0023,0.0049,0.0082,0.0115,0.0169, 0.0188};
+        std::vector<double> init_tenors {1.0/12.0, 1.0/6.0, 0.25, 0.5, 1,2,3,5,7,10,20,30};
+        simulationlib::LiborRateSimulation<double> lmm{1, 2, 8, 5, 0.25, init_rates, init_tenors};
+        lmm.setVol(0.19, 0.97, 0.08, 0.01);
+        lmm.setCorr(0.99, 0.5, 0.5);
+        lmm.setInitRate();
+        lmm.setSeed(19);
+        simulationlib::PrecisionReport report = lmm.precisionReport(4096);
+        BOOST_ASSERT_MSG(report.path_num == 4096 && report.max_path_error < 1e-5 && report.max_mean_error < 1e-6
+                         && report.max_vol_error < 1e-6 && report.max_price_error < 1e-3, "float twin does not follow the double paths");
+    }
+
+    static void testBatchRates(){
+        //getRates agrees with getRate per query below 64 queries, sorted or not, and on the SIMD path from 64 on,
+        //including queries on, before and past the curve tenors
+        std::vector<double> init_rates {0.0005, 0.0006, 0.0007, 0.0009, 0.001,0.0016, 0.0023,0.0049,0.0082,0.0115,0.0169, 0.0188};
+        std::vector<double> init_tenors {1.0/12.0, 1.0/6.0, 0.25, 0.5, 1,2,3,5,7,10,20,30};
+        simulationlib::RateInterpolation curve(init_tenors, init_rates);
+        for(size_t n : {7, 63, 64, 200}){
+            for(bool sorted : {true, false}){
+                std::vector<double> tenors(n), rates(n);
+                for(size_t q = 0; q < n; ++q) tenors[q] = sorted ? 35.0*q/(n - 1) : 35.0*((q*37) % n)/(n - 1);
+                tenors[n/2] = 5;//on a curve tenor
+                if(sorted) std::sort(tenors.begin(), tenors.end());
+                curve.getRates(tenors.data(), rates.data(), n);
+                for(size_t q = 0; q < n; ++q){
+                    BOOST_ASSERT_MSG(std::abs(rates[q] - curve.getRate(tenors[q])) < 1e-15, "batch rates differ from getRate");
+                }
+            }
+        }
+    }
+
+    static void testScenariosMatchStream(){
+        //each scenario of a common random numbers run, lockstep or blocked, gives the LiborSimulationStream of
+        //its own settings with the seed of the run
+        std::vector<double> init_rates {0.0005, 0.0006, 0.0007, 0.0009, 0.001,0.0016, 0.0023,0.0049,0.0082,0.0115,0.0169, 0.0188};
+        std::vector<double> init_tenors {1.0/12.0, 1.0/6.0, 0.25, 0.5, 1,2,3,5,7,10,20,30};
+        size_t n = 19;
+        simulationlib::LiborRateSimulation<double> base{3000, 2, 8, 5, 0.25, init_rates, init_tenors};
+        base.setVol(0.19, 0.97, 0.08, 0.01);
+        base.setCorr(0.99, 0.5, 0.5);
+        base.setInitRate();
+        base.setSeed(23);
+        base.setAntithetic(true);
+        base.setThreadNum(3);
+        simulationlib::LiborRateSimulation<double> bumped(base, 3000);
+        bumped.setVol(0.2, 0.97, 0.08, 0.01);
+        bumped.setCorr(0.9, 0.5, 0.5);
+        auto results = [n](const simulationlib::VarianceReducer<double>& stats){
+            std::vector<double> result;
+            for(size_t j = 0; j < n; ++j){
+                result.push_back(stats.mean(j));
+                result.push_back(stats.variance(j));
+            }
+            return result;
+        };
+        std::vector<std::vector<double>> streams;
+        for(simulationlib::LiborRateSimulation<double>* model : {&base, &bumped}){
+            simulationlib::LiborRateSimulation<double> single(*model, 3000);
+            simulationlib::VarianceReducer<double> stats(n);
+            single.addReducer(stats);
+            single.LiborSimulationStream();
+            streams.push_back(results(stats));
+        }
+        for(simulationlib::ScenarioOrder order : {simulationlib::ScenarioOrder::Lockstep, simulationlib::ScenarioOrder::Blocked}){
+            simulationlib::LiborRateSimulation<double> first(base, 3000), second(bumped, 3000);
+            simulationlib::VarianceReducer<double> first_stats(n), second_stats(n);
+            first.addReducer(first_stats);
+            second.addReducer(second_stats);
+            base.LiborSimulationScenarios({&first, &second}, {}, order);
+            BOOST_ASSERT_MSG(results(first_stats) == streams[0] && results(second_stats) == streams[1],
+                             "scenario run differs from the stream of its settings");
+        }
+    }
+
+    static void testStopAtTarget(){
+        //a run stopped at its target is one LiborSimulationStream of the reported path number
+        std::vector<double> init_rates {0.0005, 0.0006, 0.0007, 0.0009, 0.001,0.0016, 0.0023,0.0049,0.0082,0.0115,0.0169, 0.0188};
+        std::vector<double> init_tenors {1.0/12.0, 1.0/6.0, 0.25, 0.5, 1,2,3,5,7,10,20,30};
+        simulationlib::LiborRateSimulation<double> lmm{1, 2, 8, 5, 0.25, init_rates, init_tenors};
+        lmm.setVol(0.19, 0.97, 0.08, 0.01);
+        lmm.setCorr(0.99, 0.5, 0.5);
+        lmm.setInitRate();
+        lmm.setSeed(29);
+        lmm.setAntithetic(true);
+        simulationlib::PricingReducer<double> prices = lmm.pricingReducer();
+        prices.addCap(0.002, 1, 7);
+        lmm.addReducer(prices);
+        simulationlib::StoppingReport report = lmm.LiborSimulationToTarget(
+            {{[&]{return prices.price(0);}, [&]{return prices.stdError(0);}, 0.0, 0.002}}, 1000, 100000);
+
+        simulationlib::LiborRateSimulation<double> single(lmm, report.path_num);
+        simulationlib::PricingReducer<double> single_prices = single.pricingReducer();
+        single_prices.addCap(0.002, 1, 7);
+        single.addReducer(single_prices);
+        single.LiborSimulationStream();
+        BOOST_ASSERT_MSG(report.converged && report.batch_num > 1 && prices.price(0) == single_prices.price(0)
+                         && prices.stdError(0) == single_prices.stdError(0), "stopped run differs from one stream");
+    }
+
+    static void testBondControl(){
+        //tau*D_j*F_j = D_{j-1} - D_j on every path, so the zero strike caplet has a known price to check the bond
+        //controlled estimate against; a bond controlled by itself gives back the curve's bond exactly
+        std::vector<double> init_rates {0.0005, 0.0006, 0.0007, 0.0009, 0.001,0.0016, 0.0023,0.0049,0.0082,0.0115,0.0169, 0.0188};
+        std::vector<double> init_tenors {1.0/12.0, 1.0/6.0, 0.25, 0.5, 1,2,3,5,7,10,20,30};
+        double tau = 0.25;
+        size_t j = 12;
+        simulationlib::LiborRateSimulation<double> lmm{20000, 2, 8, 5, tau, init_rates, init_tenors};
+        lmm.setVol(0.19, 0.97, 0.08, 0.01);
+        lmm.setCorr(0.99, 0.5, 0.5);
+        lmm.setInitRate();
+        lmm.setSeed(31);
+        simulationlib::ControlVariateReducer<double> caplet = lmm.bondControlReducer([=](const simulationlib::PathView<double>& path){
+            return tau*path.discount(j)*path.forward(j);
+        }, j);
+        simulationlib::ControlVariateReducer<double> bond = lmm.bondControlReducer([=](const simulationlib::PathView<double>& path){
+            return path.discount(j);
+        }, j);
+        lmm.addReducer(caplet);
+        lmm.addReducer(bond);
+        lmm.LiborSimulationStream();
+        double exact = lmm.discountMean(j-1) - lmm.discountMean(j);
+        BOOST_ASSERT_MSG(std::abs(caplet.mean() - exact) < 4*caplet.stdError() && caplet.varianceReduction() > 1
+                         && std::abs(bond.mean() - lmm.discountMean(j)) < 1e-15, "bond control is not correct");
+    }
+};
+
+#if defined(RATE_SIMULATION_TEST)
+boost::unit_test::test_suite *init_unit_test_suite(int /*argc*/, char * /*argv*/[]) {
+    boost::unit_test_framework::test_suite *suite = BOOST_TEST_SUITE("LiborRateSimulation tests");
+    suite->add(BOOST_TEST_CASE(&LiborRateSimulationTest::testThreadPoolException));
+    suite->add(BOOST_TEST_CASE(&LiborRateSimulationTest::testThreadNumDoesNotChangeResults));
+    suite->add(BOOST_TEST_CASE(&LiborRateSimulationTest::testSwaptionFixing));
+    suite->add(BOOST_TEST_CASE(&LiborRateSimulationTest::testDriftFromFactorSums));
+    suite->add(BOOST_TEST_CASE(&LiborRateSimulationTest::testDriftOverOneStep));
+    suite->add(BOOST_TEST_CASE(&LiborRateSimulationTest::testGreeksRejectPredictorCorrector));
+    suite->add(BOOST_TEST_CASE(&LiborRateSimulationTest::testGreeksAgainstFiniteDifferences));
+    suite->add(BOOST_TEST_CASE(&LiborRateSimulationTest::testCheckpointRejectsOtherSettings));
+    suite->add(BOOST_TEST_CASE(&LiborRateSimulationTest::testShardedMatchesStream));
+    suite->add(BOOST_TEST_CASE(&LiborRateSimulationTest::testStepBiasBenchmarkKeepsRun));
+    suite->add(BOOST_TEST_CASE(&LiborRateSimulationTest::testHistogramEdges));
+    suite->add(BOOST_TEST_CASE(&LiborRateSimulationTest::testCalibrationRoundTrip));
+    suite->add(BOOST_TEST_CASE(&LiborRateSimulationTest::testPathStoreRoundTrip));
+    suite->add(BOOST_TEST_CASE(&LiborRateSimulationTest::testResumeAfterFailedRun));
+    suite->add(BOOST_TEST_CASE(&LiborRateSimulationTest::testFloatTwin));
+    suite->add(BOOST_TEST_CASE(&LiborRateSimulationTest::testBatchRates));
+    suite->add(BOOST_TEST_CASE(&LiborRateSimulationTest::testScenariosMatchStream));
+    suite->add(BOOST_TEST_CASE(&LiborRateSimulationTest::testStopAtTarget));
+    suite->add(BOOST_TEST_CASE(&LiborRateSimulationTest::testBondControl));
+    boost::unit_test_framework::framework::master_test_suite().add(suite);
+    return 0;
+}
+#else
+int main(){
+
+    int simulation_nums = 1000000;//number of simulations
+
+    double projection_years = 0.75;//years of projection
+    unsigned long num_time_steps = 3;//number of time steps
+    //projection_years/num_time_steps = length of each time step
+
+    double maturity = 1;//term structure maturity
+    double rate_freq = 0.25;//libor length
+    //maturity/rate_freq = number of rates in term structure
+
+    //time 0 rates
+    std::vector<double> init_rates {0.0005, 0.0006, 0.0007, 0.0009, 0.001,0.0016, 0.0023,0.0049,0.0082,0.0115,0.0169, 0.0188};
+    std::vector<double> init_tenors {1.0/12.0, 1.0/6.0, 0.25, 0.5, 1,2,3,5,7,10,20,30};
+    simulationlib::LiborRateSimulation<double> lmm_test{simulation_nums,projection_years, num_time_steps,maturity,
+                                                        rate_freq, init_rates, init_tenors};
+
+    //set vol assumption
+    double a = 0.19, b = 0.97, c = 0.08, d = 0.01;
+    lmm_test.setVol(a, b, c, d);
+
+    //set correlation assumption
+    double rho_inf = 0.99, lambda = 0.5, kai = 0.5;
+    lmm_test.setCorr(rho_inf, lambda, kai);
+
+    //set time 0 rates
+    lmm_test.setInitRate();
+
+    //number of worker threads, 0 uses every hardware thread
+    lmm_test.setThreadNum(0);
+
+    //simulation
+    lmm_test.LiborSimulation();
+
+
+    int rate_index = 3;
+    std::vector<int> vol_tenors{3,3,3};
+    double error = lmm_test.validateVol(rate_index, vol_tenors);
+    return 1;
+}
+#endif
\ No newline at end of file